@@ -0,0 +1,436 @@
+#ifndef __ASYNC_OUTPUT_H__
+#define __ASYNC_OUTPUT_H__
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "frameencoder.h"
+
+// AsyncOutput sends the encoded frames without waiting for the terminal,
+// so a slow terminal (e.g., over SSH) does not hold up the animation: the
+// next frame is simulated and rasterized while the last one drains.
+//
+// A finished frame is handed over by swapping the encoder's buffer with
+// a free one (nothing is copied), and written either:
+// 1. With io_uring (one write in flight at a time, so the frames reach
+//    the terminal in order; completions are picked up from the shared
+//    ring without any system call), or
+// 2. By a writer thread, where io_uring is not available.
+//
+// There are OUTPUT_SLOTS buffers. When all of them are still being
+// written, the writer has fallen behind: the next frame is skipped
+// before it is encoded. The front buffer then still holds what the
+// terminal was last sent, so the next frame that does go out carries
+// every change since (frames are coalesced, and nothing is lost).
+//
+// Anything else written to the terminal (see TerminalControl) first
+// waits for the queued frames (DrainOutput), so it is not reordered.
+//
+// Set PLOT_OUTPUT=async (io_uring, or else the writer thread) or
+// PLOT_OUTPUT=thread to turn it on; frames are written synchronously
+// otherwise (EncoderFlush).
+
+#define OUTPUT_SYNC 0
+#define OUTPUT_URING 1
+#define OUTPUT_THREAD 2
+
+// Frames which can be queued (or being written) at once.
+#define OUTPUT_SLOTS 3
+
+// Times a wait for a write to complete may be woken up (by a signal)
+// with nothing completed, before the write is given up on.
+#define URING_MAX_WAITS 100
+
+struct OutputSlot {
+  char *Buffer;
+  size_t Capacity;
+  size_t Size; // Bytes of the frame
+  size_t Sent; // Bytes written so far
+};
+
+// The parts of an io_uring instance which we use (see io_uring_setup(2)).
+struct URing {
+  int FD;
+  void *SQRing;
+  void *CQRing;
+  size_t SQRingBytes;
+  size_t CQRingBytes;
+  struct io_uring_sqe *SQEs;
+  size_t SQEBytes;
+  unsigned *SQTail, *SQMask, *SQArray;
+  unsigned *CQHead, *CQTail, *CQMask;
+  struct io_uring_cqe *CQEs;
+  int InFlight; // A write has been submitted, and has not completed
+};
+
+struct AsyncOutput {
+  int Mode;
+  int FD;
+  struct OutputSlot Slots[OUTPUT_SLOTS];
+  unsigned Head; // Frames queued so far (Slots[Head % OUTPUT_SLOTS] is next)
+  unsigned Tail; // Frames written so far
+  unsigned long Skipped; // Frames skipped because every slot was busy
+  int URingError;        // Why io_uring was given up on (0 if it was not)
+  int Lost;              // A frame was not written completely (see TakeLostFrames)
+
+  // The writer thread (Head and Tail are under Lock).
+  pthread_t Thread;
+  pthread_mutex_t Lock;
+  pthread_cond_t Queued;
+  pthread_cond_t Written;
+  int Stop;
+
+  struct URing Ring;
+};
+
+struct AsyncOutput Output = {.Mode = OUTPUT_SYNC,
+                             .Lock = PTHREAD_MUTEX_INITIALIZER,
+                             .Queued = PTHREAD_COND_INITIALIZER,
+                             .Written = PTHREAD_COND_INITIALIZER};
+
+// Write all of Slot (short writes and signals are retried). Returns 0 if
+// part of it could not be written.
+int WriteSlot(int FD, struct OutputSlot *Slot) {
+  ssize_t Status;
+  while (Slot->Sent < Slot->Size) {
+    Status = write(FD, &Slot->Buffer[Slot->Sent], Slot->Size - Slot->Sent);
+    if (Status < 0) {
+      if (errno == EINTR || (errno == EAGAIN && WaitWritable(FD)))
+        continue;
+      break;
+    }
+    Slot->Sent += Status;
+  }
+  return Slot->Sent == Slot->Size;
+}
+
+/* BEGIN io_uring */
+
+void CloseURing(struct URing *R) {
+  if (R->SQEs)
+    munmap(R->SQEs, R->SQEBytes);
+  if (R->CQRing)
+    munmap(R->CQRing, R->CQRingBytes);
+  if (R->SQRing)
+    munmap(R->SQRing, R->SQRingBytes);
+  if (R->FD >= 0)
+    close(R->FD);
+  memset(R, 0, sizeof(*R));
+  R->FD = -1;
+}
+
+// Set up an io_uring instance with room for a few writes, and map its
+// rings. Returns 0 if io_uring is not available.
+int OpenURing(struct URing *R) {
+  struct io_uring_params Params;
+  char *SQ, *CQ;
+
+  memset(R, 0, sizeof(*R));
+  memset(&Params, 0, sizeof(Params));
+  R->FD = syscall(__NR_io_uring_setup, 4, &Params);
+  if (R->FD < 0)
+    return 0;
+
+  R->SQRingBytes = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+  R->CQRingBytes = Params.cq_off.cqes + Params.cq_entries * sizeof(struct io_uring_cqe);
+  R->SQEBytes = Params.sq_entries * sizeof(struct io_uring_sqe);
+  R->SQRing = mmap(NULL, R->SQRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   R->FD, IORING_OFF_SQ_RING);
+  R->CQRing = mmap(NULL, R->CQRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   R->FD, IORING_OFF_CQ_RING);
+  R->SQEs = mmap(NULL, R->SQEBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, R->FD,
+                 IORING_OFF_SQES);
+  if (R->SQRing == MAP_FAILED || R->CQRing == MAP_FAILED || R->SQEs == MAP_FAILED) {
+    if (R->SQRing == MAP_FAILED)
+      R->SQRing = NULL;
+    if (R->CQRing == MAP_FAILED)
+      R->CQRing = NULL;
+    if (R->SQEs == MAP_FAILED)
+      R->SQEs = NULL;
+    CloseURing(R);
+    return 0;
+  }
+
+  SQ = (char *)R->SQRing;
+  CQ = (char *)R->CQRing;
+  R->SQTail = (unsigned *)(SQ + Params.sq_off.tail);
+  R->SQMask = (unsigned *)(SQ + Params.sq_off.ring_mask);
+  R->SQArray = (unsigned *)(SQ + Params.sq_off.array);
+  R->CQHead = (unsigned *)(CQ + Params.cq_off.head);
+  R->CQTail = (unsigned *)(CQ + Params.cq_off.tail);
+  R->CQMask = (unsigned *)(CQ + Params.cq_off.ring_mask);
+  R->CQEs = (struct io_uring_cqe *)(CQ + Params.cq_off.cqes);
+  return 1;
+}
+
+// Submit a write of the rest of Slot to FD. Returns 0 (with errno set)
+// if it could not be submitted.
+int SubmitURingWrite(struct URing *R, int FD, struct OutputSlot *Slot) {
+  unsigned Tail = *R->SQTail;
+  unsigned Index = Tail & *R->SQMask;
+  struct io_uring_sqe *SQE = &R->SQEs[Index];
+  long Submitted;
+
+  memset(SQE, 0, sizeof(*SQE));
+  SQE->opcode = IORING_OP_WRITE;
+  SQE->fd = FD;
+  SQE->addr = (uint64_t)(uintptr_t)&Slot->Buffer[Slot->Sent];
+  SQE->len = Slot->Size - Slot->Sent;
+  SQE->off = (uint64_t)-1; // At the file position (for a terminal, anywhere)
+  R->SQArray[Index] = Index;
+  __atomic_store_n(R->SQTail, Tail + 1, __ATOMIC_RELEASE);
+  while ((Submitted = syscall(__NR_io_uring_enter, R->FD, 1, 0, 0, NULL, 0)) < 0 &&
+         errno == EINTR)
+    ;
+  if (Submitted < 1) {
+    if (!Submitted)
+      errno = EIO;
+    return 0;
+  }
+  R->InFlight = 1;
+  return 1;
+}
+
+// Take the result of the write in flight, if it has completed. Returns
+// 0 if it has not. Waits for it if Wait is set, and returns -1 (with
+// errno set) if the wait fails, or is woken up URING_MAX_WAITS times
+// without the write completing.
+int ReapURingWrite(struct URing *R, int Wait, int *Result) {
+  unsigned Head = *R->CQHead;
+  int Waits = 0;
+
+  while (Head == __atomic_load_n(R->CQTail, __ATOMIC_ACQUIRE)) {
+    if (!Wait)
+      return 0;
+    if (++Waits > URING_MAX_WAITS) {
+      errno = ETIME;
+      return -1;
+    }
+    if (syscall(__NR_io_uring_enter, R->FD, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        errno != EINTR)
+      return -1;
+  }
+  *Result = R->CQEs[Head & *R->CQMask].res;
+  __atomic_store_n(R->CQHead, Head + 1, __ATOMIC_RELEASE);
+  R->InFlight = 0;
+  return 1;
+}
+
+// io_uring stopped working (errno says why): write the queued frames,
+// and any frame after them, synchronously instead.
+void AbandonURing(struct AsyncOutput *O) {
+  O->URingError = errno ? errno : EIO;
+  CloseURing(&O->Ring);
+  for (; O->Tail != O->Head; O->Tail++) {
+    if (!WriteSlot(O->FD, &O->Slots[O->Tail % OUTPUT_SLOTS]))
+      O->Lost = 1;
+  }
+  O->Mode = OUTPUT_SYNC;
+}
+
+// Move the io_uring output along: take the completed write (waiting for
+// it if Wait is set), and start writing whatever comes next.
+void PumpURing(struct AsyncOutput *O, int Wait) {
+  struct OutputSlot *Slot;
+  int Reaped, Result;
+
+  if (O->Ring.InFlight) {
+    Reaped = ReapURingWrite(&O->Ring, Wait, &Result);
+    if (!Reaped)
+      return;
+    Slot = &O->Slots[O->Tail % OUTPUT_SLOTS];
+    // How much of a write which was given up on went out is unknown, so
+    // it is dropped (rather than maybe sent twice).
+    if (Reaped < 0) {
+      Slot->Sent = Slot->Size;
+      O->Lost = 1;
+      O->Tail++;
+      AbandonURing(O);
+      return;
+    }
+    if (Result > 0)
+      Slot->Sent += Result;
+    // A frame which cannot be written at all is dropped, like write(2)
+    // errors are in EncoderFlush.
+    else if (Result != -EINTR && Result != -EAGAIN) {
+      Slot->Sent = Slot->Size;
+      O->Lost = 1;
+    }
+    if (Slot->Sent == Slot->Size)
+      O->Tail++;
+  }
+  if (O->Tail != O->Head && !SubmitURingWrite(&O->Ring, O->FD, &O->Slots[O->Tail % OUTPUT_SLOTS]))
+    AbandonURing(O);
+}
+
+/* END io_uring */
+
+/* BEGIN Writer thread */
+
+void *WriteFrames(void *Arg) {
+  struct AsyncOutput *O = (struct AsyncOutput *)Arg;
+
+  pthread_mutex_lock(&O->Lock);
+  for (;;) {
+    while (O->Tail == O->Head && !O->Stop)
+      pthread_cond_wait(&O->Queued, &O->Lock);
+    if (O->Tail == O->Head)
+      break;
+    // The slot is ours until Tail moves past it.
+    pthread_mutex_unlock(&O->Lock);
+    if (!WriteSlot(O->FD, &O->Slots[O->Tail % OUTPUT_SLOTS]))
+      __atomic_store_n(&O->Lost, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&O->Lock);
+    O->Tail++;
+    pthread_cond_broadcast(&O->Written);
+  }
+  pthread_mutex_unlock(&O->Lock);
+  return NULL;
+}
+
+/* END Writer thread */
+
+// Send the frames written to FD asynchronously. Mode is "async" (io_uring,
+// or the writer thread if io_uring is not available) or "thread".
+// Returns 0 (and keeps writing synchronously) if neither can be used.
+int StartAsyncOutput(struct AsyncOutput *O, int FD, const char *Mode) {
+  O->FD = FD;
+  O->Head = O->Tail = 0;
+  O->Stop = 0;
+  O->URingError = 0;
+  if (!strcmp(Mode, "async") && OpenURing(&O->Ring)) {
+    O->Mode = OUTPUT_URING;
+    return 1;
+  }
+  if ((!strcmp(Mode, "async") || !strcmp(Mode, "thread")) &&
+      !pthread_create(&O->Thread, NULL, WriteFrames, O)) {
+    O->Mode = OUTPUT_THREAD;
+    return 1;
+  }
+  O->Mode = OUTPUT_SYNC;
+  return 0;
+}
+
+// Returns 1 if a frame queued before could not be written completely
+// (since the last call): the terminal does not show what was sent.
+int TakeLostFrames(struct AsyncOutput *O) {
+  return __atomic_exchange_n(&O->Lost, 0, __ATOMIC_RELAXED);
+}
+
+// Returns 1 if every slot is still being written (the writer has
+// fallen behind), in which case the next frame is to be skipped.
+int OutputBusy(struct AsyncOutput *O) {
+  int Busy;
+  switch (O->Mode) {
+  case OUTPUT_URING:
+    PumpURing(O, 0);
+    return O->Head - O->Tail == OUTPUT_SLOTS;
+  case OUTPUT_THREAD:
+    pthread_mutex_lock(&O->Lock);
+    Busy = O->Head - O->Tail == OUTPUT_SLOTS;
+    pthread_mutex_unlock(&O->Lock);
+    return Busy;
+  }
+  return 0;
+}
+
+// Send the frame encoded by Enc (see EncoderFlush): queue its buffer (and
+// give Enc a free one), unless the output is synchronous.
+// Returns the number of bytes of the frame.
+size_t SendFrame(struct AsyncOutput *O, struct FrameEncoder *Enc) {
+  struct OutputSlot *Slot;
+  char *Buffer;
+  size_t Capacity;
+
+  // An empty frame has nothing to wait for, and one which could not be
+  // encoded completely is dropped by EncoderFlush.
+  if (O->Mode == OUTPUT_SYNC || !Enc->Size || Enc->Failed)
+    return EncoderFlush(Enc);
+
+  // Anything printed through stdio must reach the terminal first.
+  fflush(stdout);
+
+  // The slot is free: OutputBusy() was checked before encoding.
+  Slot = &O->Slots[O->Head % OUTPUT_SLOTS];
+  Buffer = Slot->Buffer;
+  Capacity = Slot->Capacity;
+  Slot->Buffer = Enc->Buffer;
+  Slot->Capacity = Enc->Capacity;
+  Slot->Size = Enc->Size;
+  Slot->Sent = 0;
+  Enc->Buffer = Buffer;
+  Enc->Capacity = Capacity;
+
+  Enc->LastFrameBytes = Enc->Size;
+  Enc->TotalBytes += Enc->Size;
+  Enc->Frames++;
+  Enc->Size = 0;
+  // Whether it gets there is only known later (see TakeLostFrames).
+  Enc->LastFrameLost = 0;
+
+  if (O->Mode == OUTPUT_URING) {
+    O->Head++;
+    if (!O->Ring.InFlight)
+      PumpURing(O, 0);
+  } else {
+    pthread_mutex_lock(&O->Lock);
+    O->Head++;
+    pthread_cond_signal(&O->Queued);
+    pthread_mutex_unlock(&O->Lock);
+  }
+  return Enc->LastFrameBytes;
+}
+
+// Wait until every queued frame has been written.
+void DrainOutput(struct AsyncOutput *O) {
+  switch (O->Mode) {
+  case OUTPUT_URING:
+    while (O->Tail != O->Head)
+      PumpURing(O, 1);
+    break;
+  case OUTPUT_THREAD:
+    pthread_mutex_lock(&O->Lock);
+    while (O->Tail != O->Head)
+      pthread_cond_wait(&O->Written, &O->Lock);
+    pthread_mutex_unlock(&O->Lock);
+    break;
+  }
+}
+
+// Write out the queued frames, and go back to synchronous output.
+void StopAsyncOutput(struct AsyncOutput *O) {
+  int i;
+
+  DrainOutput(O);
+  if (O->Mode == OUTPUT_URING) {
+    CloseURing(&O->Ring);
+  } else if (O->Mode == OUTPUT_THREAD) {
+    pthread_mutex_lock(&O->Lock);
+    O->Stop = 1;
+    pthread_cond_signal(&O->Queued);
+    pthread_mutex_unlock(&O->Lock);
+    pthread_join(O->Thread, NULL);
+  }
+  if (O->URingError)
+    fprintf(stderr, "Output: io_uring failed (%s), the frames were written synchronously since\n",
+            strerror(O->URingError));
+  if (O->Skipped)
+    fprintf(stderr, "Output: %lu frames skipped (the terminal fell behind)\n", O->Skipped);
+  for (i = 0; i < OUTPUT_SLOTS; ++i) {
+    free(O->Slots[i].Buffer);
+    memset(&O->Slots[i], 0, sizeof(O->Slots[i]));
+  }
+  O->Mode = OUTPUT_SYNC;
+  O->Skipped = 0;
+  O->URingError = 0;
+}
+
+#endif
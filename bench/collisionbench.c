@@ -0,0 +1,67 @@
+#include <stdio.h>
+
+#include "plotutils.h"
+
+// Measures what collisions (see collision.h) add to UpdatePoints.
+//
+// For every point count from MinPoints to MaxPoints (10 times more every
+// time), the same random scene of Width x Height cells is moved Steps
+// times without collisions, then Steps times with them.
+//
+// Usage: ./collisionbench.exe [MinPoints] [MaxPoints] [Width] [Height] [Steps]
+// Output (CSV): points,width,height,steps,plain_ns_per_step,collide_ns_per_step,
+//               ns_per_point,overhead,shared_per_step,crossed_per_step
+
+// Move the scene Steps times. Returns the time it took.
+long long RunSteps(int Steps) {
+  long long Start = NowNs();
+  int Step;
+  for (Step = 0; Step < Steps; ++Step)
+    UpdatePoints();
+  return NowNs() - Start;
+}
+
+void MakeScene(int NumPoints) {
+  SeedRandom(&PointRandom, 1);
+  ColorSelector = 0;
+  CharacterSelector = 0;
+  DeletePoints();
+  GenRandPoints(NumPoints);
+}
+
+int main(int argc, char **argv) {
+  int MinPoints = argc > 1 ? atoi(argv[1]) : 10000;
+  int MaxPoints = argc > 2 ? atoi(argv[2]) : 1000000;
+  int Width = argc > 3 ? atoi(argv[3]) : 1000;
+  int Height = argc > 4 ? atoi(argv[4]) : 1000;
+  int Steps = argc > 5 ? atoi(argv[5]) : 20;
+  int NumPoints;
+  long long Plain, Collide;
+
+  XRange = Width;
+  YRange = Height;
+  printf("points,width,height,steps,plain_ns_per_step,collide_ns_per_step,ns_per_point,overhead,"
+         "shared_per_step,crossed_per_step\n");
+  for (NumPoints = MinPoints; NumPoints <= MaxPoints; NumPoints *= 10) {
+    MakeScene(NumPoints);
+    Collisions.Enabled = 0;
+    Plain = RunSteps(Steps);
+
+    MakeScene(NumPoints);
+    Collisions.Enabled = 1;
+    // The first step sizes the grid (and has no cells of before).
+    UpdatePoints();
+    Collisions.Shared = Collisions.Crossed = 0;
+    Collide = RunSteps(Steps);
+
+    printf("%d,%d,%d,%d,%lld,%lld,%.2f,%.2f,%.1f,%.1f\n", NumPoints, Width, Height, Steps,
+           Plain / Steps, Collide / Steps, (double)Collide / Steps / NumPoints,
+           (double)Collide / (Plain ? Plain : 1), (double)Collisions.Shared / Steps,
+           (double)Collisions.Crossed / Steps);
+    if (NumPoints > MaxPoints / 10)
+      break;
+  }
+
+  DeletePoints();
+  return 0;
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "part5/driverutils.h"
+
+// Checks that input survives a driver which cannot be read, without any
+// hardware: the device paths are pointed at ordinary files (see
+// OpenDrivers).
+// 1. The text drivers, with /dev/SW pointing at a directory (pread fails
+//    with EISDIR): SampleAll leaves its bit out of the mask, and
+//    ReadKEYSW keeps the last switches while the KEYs still come in.
+//    With both of them failing, ReadKEYSW returns 0.
+// 2. /dev/KEYSW pointing at /dev/null (no state page, and the ioctl
+//    fails): ReadKEYSW returns 0 and counts the failure, rather than
+//    exiting.
+//
+// `make check` runs it. Exits with 1 on any failure.
+
+int Failures = 0;
+
+#define EXPECT(Condition, ...)                                                 \
+  if (!(Condition)) {                                                          \
+    fprintf(stderr, __VA_ARGS__);                                              \
+    Failures++;                                                                \
+  }
+
+// A text driver sample, in a file of its own.
+const char *SampleFile(char *Path, const char *Sample) {
+  int FD = mkstemp(Path);
+  if (FD == -1 || write(FD, Sample, strlen(Sample)) != (ssize_t)strlen(Sample)) {
+    perror(Path);
+    exit(1);
+  }
+  close(FD);
+  return Path;
+}
+
+void CheckTextDrivers() {
+  char SWPath[] = "/tmp/drivertest.SW.XXXXXX", KEYPath[] = "/tmp/drivertest.KEY.XXXXXX";
+  struct KEYSWState State = {.Switches = 0x5a5, .Keys = 0xf};
+  uint32_t Values[NUM_DRIVERS];
+  int Sampled;
+
+  SampleFile(SWPath, "682\n");
+  SampleFile(KEYPath, "3\n");
+  setenv("KEYSW_DEVICE", "/nonexistent/KEYSW", 1);
+  setenv("SW_DEVICE", SWPath, 1);
+  setenv("KEY_DEVICE", KEYPath, 1);
+  OpenDrivers();
+  EXPECT(ReadKEYSW(&State) && State.Switches == 0x2aa && State.Keys == 0x3,
+         "Both drivers: switches %#x, KEYs %#x\n", State.Switches, State.Keys);
+
+  // Now /dev/SW cannot be read.
+  close(Drivers[SW].FD);
+  Drivers[SW].FD = open("/tmp", O_RDONLY);
+  Sampled = SampleAll(Values);
+  EXPECT(Sampled == 1 << KEY, "SampleAll mask %#x with SW failing\n", Sampled);
+  EXPECT(Drivers[SW].Failures == 1 && Drivers[SW].Error == EISDIR && !Drivers[KEY].Failures,
+         "SW failures %lu (%s), KEY failures %lu\n", Drivers[SW].Failures,
+         strerror(Drivers[SW].Error), Drivers[KEY].Failures);
+  EXPECT(ReadKEYSW(&State) && State.Switches == 0x2aa && State.Keys == 0x3,
+         "SW failing: switches %#x, KEYs %#x\n", State.Switches, State.Keys);
+
+  // And /dev/KEY neither.
+  close(Drivers[KEY].FD);
+  Drivers[KEY].FD = open("/tmp", O_RDONLY);
+  State = (struct KEYSWState){.Switches = 0x5a5, .Keys = 0xf};
+  Sampled = SampleAll(Values);
+  EXPECT(Sampled == 0, "SampleAll mask %#x with both failing\n", Sampled);
+  EXPECT(!ReadKEYSW(&State) && State.Switches == 0x5a5 && State.Keys == 0xf,
+         "Both failing: State was changed\n");
+
+  ReleaseDrivers();
+  Drivers[SW].FD = Drivers[KEY].FD = -1;
+  unlink(SWPath);
+  unlink(KEYPath);
+}
+
+void CheckKEYSWDriver() {
+  struct KEYSWState State = {.Switches = 0x5a5, .Keys = 0xf};
+
+  setenv("KEYSW_DEVICE", "/dev/null", 1);
+  OpenDrivers();
+  EXPECT(KEYSWFD != -1 && !StatePage, "/dev/null was not opened as /dev/KEYSW\n");
+  EXPECT(!ReadKEYSW(&State) && State.Switches == 0x5a5 && State.Keys == 0xf,
+         "Failing ioctl: ReadKEYSW did not return 0, or changed State\n");
+  EXPECT(KEYSWFailures == 1 && KEYSWError == ENOTTY, "KEYSW failures %lu (%s)\n", KEYSWFailures,
+         strerror(KEYSWError));
+  ReleaseDrivers();
+  KEYSWFD = -1;
+}
+
+int main() {
+  CheckTextDrivers();
+  CheckKEYSWDriver();
+  printf("drivertest: %d failures\n", Failures);
+  return Failures ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "plotutils.h"
+
+// Checks the point handles (see PointHandle in plotutils.h) through a
+// churn of points being created and removed:
+// 1. Every live handle finds its own point, wherever removals have moved
+//    it to, and handles of removed points are stale (LookupPoint returns
+//    -1, DeletePoint returns 0).
+// 2. Freed slots are reused, under a new generation.
+// 3. A slot whose generation wraps around skips 0, and the handle from
+//    before the wrap stays stale.
+//
+// `make check` runs it. Exits with 1 on any failure.
+
+#define MAX_LIVE 500
+#define ROUNDS 20000
+
+int Failures = 0;
+
+#define EXPECT(Condition, ...)                                                 \
+  if (!(Condition)) {                                                          \
+    fprintf(stderr, __VA_ARGS__);                                              \
+    Failures++;                                                                \
+  }
+
+// The point each handle was created for is told apart by its X (its
+// serial number), which moves along with it.
+int CheckHandles(struct PointHandle *Live, int *Serial, int LiveCount) {
+  int k, i;
+  for (k = 0; k < LiveCount; ++k) {
+    i = LookupPoint(Live[k]);
+    if (i < 0 || Points.X[i] != Serial[k]) {
+      fprintf(stderr, "Handle %d (point %d) finds index %d\n", k, Serial[k], i);
+      return 0;
+    }
+  }
+  return Points.Count == LiveCount;
+}
+
+int CheckChurn(struct PointRandom *R) {
+  struct PointHandle Live[MAX_LIVE], Stale, H;
+  int Serial[MAX_LIVE];
+  int LiveCount = 0, NextSerial = 0, Round, k;
+  uint32_t SlotsBefore;
+
+  for (Round = 0; Round < ROUNDS; ++Round) {
+    // Grow while there is room, and shrink at random.
+    if (LiveCount < MAX_LIVE && (LiveCount == 0 || RandomBelow(R, 2))) {
+      SlotsBefore = Points.NumSlots;
+      H = GenPoint(NextSerial % 30000, 1, 1, 1, RED, 'A');
+      EXPECT(H.Slot != NO_SLOT, "GenPoint failed in round %d\n", Round);
+      // Slots are only added once the free list is empty.
+      EXPECT(Points.NumSlots == SlotsBefore || Points.NumSlots == (uint32_t)LiveCount + 1,
+             "Slot %u taken while others were free\n", H.Slot);
+      Live[LiveCount] = H;
+      Serial[LiveCount++] = NextSerial++ % 30000;
+    } else {
+      k = RandomBelow(R, LiveCount);
+      Stale = Live[k];
+      EXPECT(DeletePoint(Stale), "DeletePoint of a live point failed\n");
+      Live[k] = Live[--LiveCount];
+      Serial[k] = Serial[LiveCount];
+      EXPECT(LookupPoint(Stale) == -1, "Stale handle found a point\n");
+      EXPECT(!DeletePoint(Stale), "Stale handle deleted a point\n");
+
+      // The next point takes the same slot, with a new generation.
+      H = GenPoint(NextSerial % 30000, 1, 1, 1, RED, 'A');
+      EXPECT(H.Slot == Stale.Slot && H.Generation != Stale.Generation,
+             "Slot %u (generation %u) not reused: slot %u, generation %u\n", Stale.Slot,
+             Stale.Generation, H.Slot, H.Generation);
+      EXPECT(LookupPoint(Stale) == -1, "Stale handle found the slot's new point\n");
+      Live[LiveCount] = H;
+      Serial[LiveCount++] = NextSerial++ % 30000;
+      // And goes away again half of the time.
+      if (RandomBelow(R, 2)) {
+        EXPECT(DeletePoint(H), "DeletePoint of a new point failed\n");
+        LiveCount--;
+      }
+    }
+    if (!CheckHandles(Live, Serial, LiveCount)) {
+      fprintf(stderr, "Handles broken in round %d\n", Round);
+      return 1;
+    }
+  }
+  // Only as many slots as there were points at the most.
+  EXPECT(Points.NumSlots <= MAX_LIVE + 1, "%u slots for %d points\n", Points.NumSlots, MAX_LIVE);
+  DeletePoints();
+  return 0;
+}
+
+int CheckGenerationWrap() {
+  struct PointHandle Old, H;
+
+  H = GenPoint(1, 1, 1, 1, RED, 'A');
+  DeletePoint(H);
+  // Skip ahead to the last generation, rather than freeing the slot 2^32
+  // times.
+  Points.SlotGeneration[H.Slot] = UINT32_MAX;
+  Old = GenPoint(2, 1, 1, 1, RED, 'A');
+  EXPECT(Old.Slot == H.Slot && Old.Generation == UINT32_MAX, "Slot not reused before the wrap\n");
+  EXPECT(DeletePoint(Old), "DeletePoint failed before the wrap\n");
+  EXPECT(Points.SlotGeneration[H.Slot] == 1, "Generation wrapped to %u, not 1\n",
+         Points.SlotGeneration[H.Slot]);
+
+  H = GenPoint(3, 1, 1, 1, RED, 'A');
+  EXPECT(H.Slot == Old.Slot && H.Generation == 1, "Generation %u after the wrap\n", H.Generation);
+  EXPECT(LookupPoint(Old) == -1, "Handle from before the wrap found a point\n");
+  EXPECT(LookupPoint(NO_POINT) == -1, "NO_POINT found a point\n");
+  EXPECT(LookupPoint(H) == 0 && Points.X[0] == 3, "Handle after the wrap lost its point\n");
+  DeletePoints();
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  struct PointRandom R;
+
+  SeedRandom(&R, argc > 1 ? strtoull(argv[1], NULL, 0) : 1);
+  Failures += CheckChurn(&R);
+  Failures += CheckGenerationWrap();
+  printf("handletest: %d failures\n", Failures);
+  return Failures ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pointkernels.h"
+#include "pointrandom.h"
+
+// Checks that the vector kernels give the same results as their scalar
+// references, bit for bit:
+// 1. BounceAxis against BounceAxisScalar, over hundreds of steps, for
+//    random terminal sizes (changed every so often, like a resize does)
+//    and point counts which are not all multiples of the vector width
+//    (so the scalar tail runs too).
+// 2. NextRandomLanes against NextRandomLanesScalar, and every lane
+//    against NextRandom on a generator of its own.
+//
+// Built once with the default flags and once with -mavx2 (see the
+// Makefile); `make check` runs both. Exits with 1 on any mismatch.
+
+#define MAX_POINTS 300
+#define TRIALS 200
+#define STEPS 400
+#define RESIZE_EVERY 100
+#define RANDOM_ROUNDS 10000
+
+int CheckBounceAxis(struct PointRandom *R) {
+  int16_t P[MAX_POINTS], dP[MAX_POINTS], RefP[MAX_POINTS], RefdP[MAX_POINTS];
+  int Trial, Step, Count, Range, i, Mismatches = 0;
+
+  for (Trial = 0; Trial < TRIALS; ++Trial) {
+    Count = RandomBelow(R, MAX_POINTS + 1);
+    Range = 0;
+    for (Step = 0; Step < STEPS; ++Step) {
+      if (Step % RESIZE_EVERY == 0) {
+        // Mostly terminal sizes, and now and then one past what 16 bits
+        // can hold. The points may be off the new size, like after a
+        // resize.
+        Range = 1 + RandomBelow(R, Trial % 10 ? 300 : 40000);
+        if (Step == 0) {
+          for (i = 0; i < Count; ++i) {
+            P[i] = RefP[i] = (int16_t)RandomBelow(R, Range + 10) - 5;
+            dP[i] = RefdP[i] = RandomBelow(R, 2) ? 1 : -1;
+          }
+        }
+      }
+      BounceAxis(P, dP, Count, Range);
+      BounceAxisScalar(RefP, RefdP, 0, Count, Range);
+      if (memcmp(P, RefP, sizeof(*P) * Count) || memcmp(dP, RefdP, sizeof(*dP) * Count)) {
+        fprintf(stderr, "BounceAxis differs: %d points, Range %d, step %d\n", Count, Range, Step);
+        Mismatches++;
+        break;
+      }
+    }
+  }
+  return Mismatches;
+}
+
+int CheckRandomLanes(struct PointRandom *R) {
+  struct RandomLanes L, RefL;
+  struct PointRandom Lane[RANDOM_LANES];
+  uint32_t Out[RANDOM_LANES], RefOut[RANDOM_LANES];
+  int Round, j, k;
+
+  SeedRandomLanes(&L, R);
+  RefL = L;
+  for (k = 0; k < RANDOM_LANES; ++k)
+    for (j = 0; j < 4; ++j)
+      Lane[k].S[j] = L.S[j][k];
+
+  for (Round = 0; Round < RANDOM_ROUNDS; ++Round) {
+    NextRandomLanes(&L, Out);
+    NextRandomLanesScalar(&RefL, RefOut);
+    if (memcmp(Out, RefOut, sizeof(Out)) || memcmp(&L, &RefL, sizeof(L))) {
+      fprintf(stderr, "NextRandomLanes differs in round %d\n", Round);
+      return 1;
+    }
+    for (k = 0; k < RANDOM_LANES; ++k) {
+      if (Out[k] != NextRandom(&Lane[k])) {
+        fprintf(stderr, "Lane %d differs from NextRandom in round %d\n", k, Round);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  struct PointRandom R;
+  int Mismatches;
+
+  SeedRandom(&R, argc > 1 ? strtoull(argv[1], NULL, 0) : 1);
+  Mismatches = CheckBounceAxis(&R);
+  Mismatches += CheckRandomLanes(&R);
+  printf("kerneltest (%s): %d mismatches\n", BOUNCE_KERNEL, Mismatches);
+  return Mismatches ? 1 : 0;
+}
@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "plotutils.h"
+
+// Runs the plotting and animation paths of the parts without a terminal.
+//
+// Every scenario draws Frames frames into an off-screen frame of
+// Width x Height cells, and sends them (through PresentFrame) to one of
+// the sinks:
+//   null   - /dev/null
+//   pipe   - a pipe, drained by a reader thread
+//   memory - an in-memory file (rewound after every frame)
+//   grid   - the memory backend: no encoding, the frame is only copied
+//   none   - the null backend: the frame is discarded
+// (so grid and none show the cost of drawing without the cost of encoding).
+//
+// The scenarios are:
+//   line             - part3's bouncing line (drawn over with ClearLine)
+//   loop/N           - part4's closed loop of N points (ClearFrame every frame)
+//   loop-lineclear/N - the same loop, erased with ClearPointLoop (footprints)
+//   short/N, long/N  - N separate lines of at most 4 cells, or spanning
+//                      the whole frame
+//
+// Every run reports frames/s, ns per frame, bytes per frame and the
+// allocations made while the frames were drawn (malloc, calloc and
+// realloc are wrapped by the linker, see the Makefile), as CSV or as one
+// JSON object per line.
+//
+// Usage: ./plotbench.exe [-s null|pipe|memory|grid|none|all] [-f Frames] [-n MaxPoints]
+//                        [-w Width] [-h Height] [-r Filter] [-o csv|json]
+
+unsigned long long Allocations = 0;
+
+void *__real_malloc(size_t Size);
+void *__real_calloc(size_t Count, size_t Size);
+void *__real_realloc(void *Ptr, size_t Size);
+
+void *__wrap_malloc(size_t Size) {
+  __atomic_fetch_add(&Allocations, 1, __ATOMIC_RELAXED);
+  return __real_malloc(Size);
+}
+
+void *__wrap_calloc(size_t Count, size_t Size) {
+  __atomic_fetch_add(&Allocations, 1, __ATOMIC_RELAXED);
+  return __real_calloc(Count, Size);
+}
+
+void *__wrap_realloc(void *Ptr, size_t Size) {
+  __atomic_fetch_add(&Allocations, 1, __ATOMIC_RELAXED);
+  return __real_realloc(Ptr, Size);
+}
+
+/* BEGIN Sinks */
+
+#define SINK_NULL 0
+#define SINK_PIPE 1
+#define SINK_MEMORY 2
+#define SINK_GRID 3
+#define SINK_NONE 4
+#define NUM_SINKS 5
+
+const char *SinkNames[NUM_SINKS] = {"null", "pipe", "memory", "grid", "none"};
+
+int SinkFD = -1;
+int PipeReadFD = -1;
+pthread_t PipeReader;
+
+void *DrainPipe(void *Unused) {
+  char Buffer[65536];
+  while (read(PipeReadFD, Buffer, sizeof(Buffer)) > 0)
+    ;
+  return NULL;
+}
+
+int OpenSink(int Sink) {
+  int Ends[2];
+
+  if (Sink == SINK_GRID)
+    return SelectPlotBackend("memory");
+  if (Sink == SINK_NONE)
+    return SelectPlotBackend("null");
+
+  if (Sink == SINK_NULL) {
+    SinkFD = open("/dev/null", O_WRONLY);
+  } else if (Sink == SINK_PIPE) {
+    if (pipe(Ends))
+      return 0;
+    PipeReadFD = Ends[0];
+    SinkFD = Ends[1];
+    if (pthread_create(&PipeReader, NULL, DrainPipe, NULL)) {
+      close(Ends[0]);
+      close(Ends[1]);
+      return 0;
+    }
+  } else {
+    SinkFD = memfd_create("plotbench", 0);
+  }
+  Encoder.OutputFD = SinkFD;
+  return SinkFD >= 0;
+}
+
+// Called after every frame.
+void RewindSink(int Sink) {
+  if (Sink == SINK_MEMORY)
+    lseek(SinkFD, 0, SEEK_SET);
+}
+
+void CloseSink(int Sink) {
+  if (Sink == SINK_GRID || Sink == SINK_NONE) {
+    SelectPlotBackend("terminal");
+    return;
+  }
+  close(SinkFD);
+  if (Sink == SINK_PIPE) {
+    pthread_join(PipeReader, NULL);
+    close(PipeReadFD);
+  }
+  SinkFD = -1;
+  Encoder.OutputFD = STDOUT_FILENO;
+}
+
+/* END Sinks */
+
+
+/* BEGIN Scenarios */
+
+struct Scenario {
+  const char *Name;
+  void (*Setup)(int N);
+  void (*Frame)();
+  int Points; // Largest N to use (0 if the scenario has no N)
+};
+
+// part3: a horizontal line bouncing up and down.
+int CurrentY, Inc, LineColor;
+
+void SetupLine(int Unused) {
+  CurrentY = 1;
+  Inc = 1;
+  LineColor = 0;
+}
+
+void FrameLine() {
+  PlotLine(0, CurrentY, XRange, CurrentY, Colors[LineColor % NUM_COLORS]);
+  PresentFrame();
+  ClearLine(0, CurrentY, XRange, CurrentY);
+  CurrentY += Inc ? 1 : -1;
+  if (CurrentY >= YRange)
+    Inc = 0;
+  if (CurrentY <= 1)
+    Inc = 1;
+  LineColor++;
+}
+
+// part4: the closed loop of points.
+void SetupLoop(int Count) {
+  GenRandPoints(Count);
+}
+
+void FrameLoop() {
+  ClearFrame();
+  PlotPointLoop(1);
+  PresentFrame();
+  UpdatePoints();
+}
+
+void SetupLoopLineClear(int Count) {
+  RecordFootprint(&Footprint, 1, FrameWidth * FrameHeight);
+  SetupLoop(Count);
+}
+
+void FrameLoopLineClear() {
+  PlotPointLoop(1);
+  PresentFrame();
+  ClearPointLoop();
+  UpdatePoints();
+}
+
+// The loop of points, filled (see polygonfill.h).
+void SetupFillEvenOdd(int Count) {
+  PolygonFill.Rule = FILL_EVEN_ODD;
+  SetupLoop(Count);
+}
+
+void SetupFillNonzero(int Count) {
+  PolygonFill.Rule = FILL_NONZERO;
+  SetupLoop(Count);
+}
+
+// Separate lines: each point is the start of a line of its own, which
+// runs to (X + dX * Length, Y + dY * Length / 2).
+int LineLength;
+
+void SetupShort(int Count) {
+  LineLength = 3;
+  SetupLoop(Count);
+}
+
+void SetupLong(int Count) {
+  LineLength = XRange > YRange ? XRange : YRange;
+  SetupLoop(Count);
+}
+
+void FrameLines() {
+  int i;
+  ClearFrame();
+  ForEachPoint(i) {
+    BatchLine(Points.X[i], Points.Y[i], Points.X[i] + Points.dX[i] * LineLength,
+              Points.Y[i] + Points.dY[i] * (LineLength / 2), Points.Color[i], '*');
+  }
+  RunRasterBatch();
+  PresentFrame();
+  UpdatePoints();
+}
+
+struct Scenario Scenarios[] = {
+    {"line", SetupLine, FrameLine, 0},
+    {"loop", SetupLoop, FrameLoop, 100000},
+    {"loop-lineclear", SetupLoopLineClear, FrameLoopLineClear, 100000},
+    {"fill-evenodd", SetupFillEvenOdd, FrameLoop, 10000},
+    {"fill-nonzero", SetupFillNonzero, FrameLoop, 10000},
+    {"short", SetupShort, FrameLines, 100000},
+    {"long", SetupLong, FrameLines, 10000},
+};
+
+#define NUM_SCENARIOS (int)(sizeof(Scenarios) / sizeof(Scenarios[0]))
+
+/* END Scenarios */
+
+int Json = 0;
+
+void PrintHeader() {
+  if (!Json)
+    printf("scenario,points,sink,width,height,frames,fps,ns_per_frame,bytes_per_frame,allocations\n");
+}
+
+void PrintResult(const char *Name, int Points, int Sink, int Frames, long long Elapsed,
+                 unsigned long long Bytes, unsigned long long Allocs) {
+  double Fps = Elapsed ? Frames * (double)NS_PER_SEC / Elapsed : 0;
+  if (Json)
+    printf("{\"scenario\":\"%s\",\"points\":%d,\"sink\":\"%s\",\"width\":%d,\"height\":%d,"
+           "\"frames\":%d,\"fps\":%.2f,\"ns_per_frame\":%lld,\"bytes_per_frame\":%.1f,"
+           "\"allocations\":%llu}\n",
+           Name, Points, SinkNames[Sink], FrameWidth, FrameHeight, Frames, Fps,
+           Elapsed / Frames, (double)Bytes / Frames, Allocs);
+  else
+    printf("%s,%d,%s,%d,%d,%d,%.2f,%lld,%.1f,%llu\n", Name, Points, SinkNames[Sink],
+           FrameWidth, FrameHeight, Frames, Fps, Elapsed / Frames, (double)Bytes / Frames,
+           Allocs);
+  fflush(stdout);
+}
+
+// Run scenario S with Count points into Sink.
+void RunScenario(struct Scenario *S, int Count, int Sink, int Frames) {
+  int Frame;
+  long long Start, Elapsed;
+  unsigned long long Bytes, Allocs;
+
+  // Every run starts from the same blank frame and the same points.
+  SeedRandom(&PointRandom, 1);
+  ColorSelector = 0;
+  CharacterSelector = 0;
+  BlankCells(FrontBuffer, FrameWidth * FrameHeight);
+  BlankCells(BackBuffer, FrameWidth * FrameHeight);
+  EncoderInvalidate(&Encoder);
+  if (!OpenSink(Sink)) {
+    fprintf(stderr, "Could not open the %s sink\n", SinkNames[Sink]);
+    return;
+  }
+  S->Setup(Count);
+  // One frame to warm up: the tables which grow to the size of the scene
+  // (the encoder's buffer, the raster bins, the fill's edge table...) do
+  // so here, and are not counted as allocations of the run.
+  S->Frame();
+  RewindSink(Sink);
+
+  Bytes = Encoder.TotalBytes;
+  Allocs = Allocations;
+  Start = NowNs();
+  for (Frame = 0; Frame < Frames; ++Frame) {
+    S->Frame();
+    RewindSink(Sink);
+  }
+  Elapsed = NowNs() - Start;
+  Bytes = Encoder.TotalBytes - Bytes;
+  Allocs = Allocations - Allocs;
+
+  PrintResult(S->Name, Count, Sink, Frames, Elapsed, Bytes, Allocs);
+  CloseSink(Sink);
+  DeletePoints();
+  RecordFootprint(&Footprint, 0, 0);
+  PolygonFill.Rule = FILL_NONE;
+}
+
+int main(int argc, char **argv) {
+  int Frames = 100;
+  int MaxPoints = 100000;
+  int Width = 200;
+  int Height = 60;
+  int FirstSink = SINK_NULL, LastSink = SINK_NULL;
+  const char *Filter = NULL;
+  int Option, i, Sink, Count;
+
+  while ((Option = getopt(argc, argv, "s:f:n:w:h:r:o:")) != -1) {
+    switch (Option) {
+    case 's':
+      if (!strcmp(optarg, "all")) {
+        FirstSink = 0;
+        LastSink = NUM_SINKS - 1;
+        break;
+      }
+      for (i = 0; i < NUM_SINKS && strcmp(optarg, SinkNames[i]); ++i)
+        ;
+      if (i == NUM_SINKS) {
+        fprintf(stderr, "Unknown sink: %s\n", optarg);
+        return 1;
+      }
+      FirstSink = LastSink = i;
+      break;
+    case 'f':
+      Frames = atoi(optarg);
+      break;
+    case 'n':
+      MaxPoints = atoi(optarg);
+      break;
+    case 'w':
+      Width = atoi(optarg);
+      break;
+    case 'h':
+      Height = atoi(optarg);
+      break;
+    case 'r':
+      Filter = optarg;
+      break;
+    case 'o':
+      Json = !strcmp(optarg, "json");
+      break;
+    default:
+      return 1;
+    }
+  }
+  if (Frames < 1 || Width < 1 || Height < 1)
+    return 1;
+
+  // The frame is created up front, so BeginFrame() never has to clear
+  // the (nonexistent) terminal.
+  XRange = Width;
+  YRange = Height;
+  if (!AllocateFrame(Width, Height))
+    return 1;
+
+  PrintHeader();
+  for (i = 0; i < NUM_SCENARIOS; ++i) {
+    if (Filter && !strstr(Scenarios[i].Name, Filter))
+      continue;
+    for (Sink = FirstSink; Sink <= LastSink; ++Sink) {
+      if (!Scenarios[i].Points) {
+        RunScenario(&Scenarios[i], 0, Sink, Frames);
+        continue;
+      }
+      for (Count = 10; Count <= MaxPoints && Count <= Scenarios[i].Points; Count *= 10)
+        RunScenario(&Scenarios[i], Count, Sink, Frames);
+    }
+  }
+
+  ReleaseRasterBatch();
+  ReleaseFootprint(&Footprint);
+  ReleaseEncoder(&Encoder);
+  ReleaseFrame();
+  return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "plotutils.h"
+
+// Measures how the tile rasterizer scales with the number of threads.
+//
+// A closed loop of Points random points is drawn (and moved) into an
+// off-screen frame of Width x Height cells for Frames frames, once for
+// every thread count from 1 to MaxThreads. Every run must leave exactly
+// the same back buffer as the single-threaded run.
+//
+// Usage: ./rasterbench.exe [Points] [MaxThreads] [Width] [Height] [Frames]
+// Output (CSV): threads,points,width,height,frames,ns_per_frame,speedup,identical
+
+int main(int argc, char **argv) {
+  int NumPoints = argc > 1 ? atoi(argv[1]) : 10000;
+  int MaxThreads = argc > 2 ? atoi(argv[2]) : 8;
+  int Width = argc > 3 ? atoi(argv[3]) : 400;
+  int Height = argc > 4 ? atoi(argv[4]) : 200;
+  int Frames = argc > 5 ? atoi(argv[5]) : 50;
+  int Threads, Frame, Identical;
+  long long Start, Elapsed, SerialNs = 0;
+  struct Cell *Reference;
+
+  XRange = Width;
+  YRange = Height;
+  if (!AllocateFrame(Width, Height))
+    return 1;
+  Reference = (struct Cell *)malloc(sizeof(struct Cell) * Width * Height);
+  if (!Reference)
+    return 1;
+
+  printf("threads,points,width,height,frames,ns_per_frame,speedup,identical\n");
+  for (Threads = 1; Threads <= MaxThreads; ++Threads) {
+    SetRasterThreads(Threads);
+
+    // Every run animates the same scene.
+    SeedRandom(&PointRandom, 1);
+    ColorSelector = 0;
+    CharacterSelector = 0;
+    DeletePoints();
+    GenRandPoints(NumPoints);
+
+    Start = NowNs();
+    for (Frame = 0; Frame < Frames; ++Frame) {
+      ClearFrame();
+      PlotPointLoop(1);
+      UpdatePoints();
+    }
+    Elapsed = NowNs() - Start;
+
+    if (Threads == 1) {
+      memcpy(Reference, BackBuffer, sizeof(struct Cell) * Width * Height);
+      SerialNs = Elapsed;
+    }
+    Identical = !memcmp(Reference, BackBuffer, sizeof(struct Cell) * Width * Height);
+
+    printf("%d,%d,%d,%d,%d,%lld,%.2f,%d\n", RasterThreads, NumPoints, Width,
+           Height, Frames, Elapsed / Frames, (double)SerialNs / Elapsed, Identical);
+  }
+
+  free(Reference);
+  DeletePoints();
+  ReleaseRasterBatch();
+  ReleaseFrame();
+  return 0;
+}
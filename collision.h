@@ -0,0 +1,258 @@
+#ifndef __COLLISION_H__
+#define __COLLISION_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Point-to-point collisions, on a uniform grid of the terminal's cells.
+//
+// After every step, the points are sorted by cell into buckets with a
+// counting sort (one pass to count, one to place them). The cells are
+// hashed into about twice as many buckets as there are points (rather
+// than having a bucket for each cell), so a step costs O(points) however
+// large the frame is, and nothing is allocated once the grid has its size.
+// Collisions are then found by only looking into buckets:
+// 1. Points which share a cell bounce off each other (two at a time):
+//    they swap their directions, like equal masses do.
+// 2. Points whose paths crossed during the step (so they never shared a
+//    cell) go back along the axes they crossed on, and swap directions on
+//    them, as if they had met half way.
+// A point bounces at most once per step.
+//
+// Crossing needs the cell of every point before the step, so it is only
+// checked when the points and the frame are the same as at the last step
+// (not right after points were added or removed, or the frame resized).
+// Whoever adds or removes points calls ForgetLastCells: the number of
+// points alone does not tell (one removed and one added keeps it).
+
+struct CollisionGrid {
+  int Enabled;
+  int Width, Height;    // Size of the grid (in cells)
+  int BucketBits;       // There are 2^BucketBits buckets
+  uint32_t *Start;      // Points of bucket b: Order[Start[b] .. Start[b + 1] - 1]
+  uint32_t *Order;      // Point indices, sorted by bucket
+  uint32_t *Cell;       // Cell of each point (as of the last step)
+  uint32_t *LastCell;   // Cell of each point before that
+  uint32_t *Bounced;    // Step in which each point last bounced
+  int Count;            // Points in the grid
+  int Capacity;         // Points the arrays can hold
+  uint32_t Step;        // Steps run (never 0)
+  int HaveLastCells;    // LastCell is valid for these points
+
+  // Statistics
+  unsigned long long Shared;  // Bounces of points sharing a cell
+  unsigned long long Crossed; // Bounces of points which crossed
+};
+
+struct CollisionGrid Collisions = {0};
+
+void ReleaseCollisionGrid(struct CollisionGrid *G) {
+  free(G->Start);
+  free(G->Order);
+  free(G->Cell);
+  free(G->LastCell);
+  free(G->Bounced);
+  G->Start = G->Order = G->Cell = G->LastCell = G->Bounced = NULL;
+  G->Count = G->Capacity = 0;
+  G->HaveLastCells = 0;
+}
+
+// The points were added to, removed or reordered: the cells of the last
+// step no longer belong to them.
+void ForgetLastCells(struct CollisionGrid *G) { G->HaveLastCells = 0; }
+
+// The bucket of cell C.
+static inline uint32_t CellBucket(struct CollisionGrid *G, uint32_t C) {
+  return (C * 2654435761u) >> (32 - G->BucketBits); // Fibonacci hashing
+}
+
+// Make room for Count points (the arrays only grow, by doubling). There
+// are twice as many buckets as the points can be. Returns 0 if the memory
+// could not be allocated.
+int ReserveCollisionGrid(struct CollisionGrid *G, int Count) {
+  int NewCapacity;
+  void *Grown;
+
+  if (Count <= G->Capacity)
+    return 1;
+
+  NewCapacity = G->Capacity ? G->Capacity : 64;
+  while (NewCapacity < Count)
+    NewCapacity <<= 1;
+#define GROW_GRID(Field, Size)                                                 \
+  if (!(Grown = realloc(G->Field, sizeof(uint32_t) * (Size))))                 \
+    return 0;                                                                  \
+  G->Field = Grown;
+
+  GROW_GRID(Start, 2 * NewCapacity + 1)
+  GROW_GRID(Order, NewCapacity)
+  GROW_GRID(Cell, NewCapacity)
+  GROW_GRID(LastCell, NewCapacity)
+  GROW_GRID(Bounced, NewCapacity)
+#undef GROW_GRID
+  // No point has bounced in the new entries.
+  memset(&G->Bounced[G->Capacity], 0, sizeof(uint32_t) * (NewCapacity - G->Capacity));
+  G->Capacity = NewCapacity;
+  for (G->BucketBits = 1; (1 << G->BucketBits) < 2 * NewCapacity; ++G->BucketBits)
+    ;
+  return 1;
+}
+
+// The cell of a point at (PX, PY). A point off the grid (e.g., before a
+// resize moved it back) counts as being on its edge.
+static inline uint32_t PointCell(struct CollisionGrid *G, int PX, int PY) {
+  PX = PX < 1 ? 1 : PX > G->Width ? G->Width : PX;
+  PY = PY < 1 ? 1 : PY > G->Height ? G->Height : PY;
+  return (uint32_t)(PY - 1) * G->Width + (PX - 1);
+}
+
+// Sort the points into the buckets of their cells (a counting sort).
+void BucketPoints(struct CollisionGrid *G, int16_t *X, int16_t *Y, int Count) {
+  uint32_t NumBuckets = 1u << G->BucketBits;
+  uint32_t *Swap;
+  int i;
+  uint32_t b;
+
+  // The cells of the last step become the cells before this one.
+  Swap = G->LastCell;
+  G->LastCell = G->Cell;
+  G->Cell = Swap;
+
+  memset(G->Start, 0, sizeof(uint32_t) * (NumBuckets + 1));
+  for (i = 0; i < Count; ++i) {
+    G->Cell[i] = PointCell(G, X[i], Y[i]);
+    G->Start[CellBucket(G, G->Cell[i]) + 1]++;
+  }
+  for (b = 1; b <= NumBuckets; ++b)
+    G->Start[b] += G->Start[b - 1];
+  // Start[b] is moved to the end of bucket b while placing its points, so
+  // it ends up where Start[b + 1] was: shift it back afterwards.
+  for (i = 0; i < Count; ++i)
+    G->Order[G->Start[CellBucket(G, G->Cell[i])]++] = i;
+  for (b = NumBuckets; b > 0; --b)
+    G->Start[b] = G->Start[b - 1];
+  G->Start[0] = 0;
+}
+
+// Points A and B bounce off each other: they swap the directions of the
+// given axes (1: X, 2: Y, 3: both), and stay off the walls, like
+// BounceAxis keeps them.
+void BouncePoints(struct CollisionGrid *G, int16_t *X, int16_t *Y, int16_t *dX, int16_t *dY,
+                  uint32_t A, uint32_t B, int Axes) {
+  int16_t Tmp;
+  uint32_t P;
+  int i;
+
+  if (Axes & 1)
+    Tmp = dX[A], dX[A] = dX[B], dX[B] = Tmp;
+  if (Axes & 2)
+    Tmp = dY[A], dY[A] = dY[B], dY[B] = Tmp;
+  for (i = 0; i < 2; ++i) {
+    P = i ? B : A;
+    if (X[P] <= 1)
+      dX[P] = 1;
+    if (X[P] >= G->Width)
+      dX[P] = -1;
+    if (Y[P] <= 1)
+      dY[P] = 1;
+    if (Y[P] >= G->Height)
+      dY[P] = -1;
+    G->Bounced[P] = G->Step;
+  }
+}
+
+// Look for a point B, not bounced yet, which is in cell Now and was in
+// cell Then before the step. Returns 0 if there is none.
+int FindCrossing(struct CollisionGrid *G, uint32_t Now, uint32_t Then, uint32_t *B) {
+  uint32_t k, End = G->Start[CellBucket(G, Now) + 1];
+
+  for (k = G->Start[CellBucket(G, Now)]; k < End; ++k) {
+    *B = G->Order[k];
+    if (G->Cell[*B] == Now && G->LastCell[*B] == Then && G->Bounced[*B] != G->Step)
+      return 1;
+  }
+  return 0;
+}
+
+// Find and resolve the collisions of the step just run (the points have
+// moved already). Width and Height are the size of the frame.
+void CollidePoints(struct CollisionGrid *G, int16_t *X, int16_t *Y, int16_t *dX, int16_t *dY,
+                   int Count, int Width, int Height) {
+  uint32_t k, j, End, A, B, Before, BeforeX, BeforeY, AfterX, AfterY;
+  int16_t Tmp;
+  int i, Axes;
+
+  if (Width < 1 || Height < 1)
+    return;
+  if (!ReserveCollisionGrid(G, Count)) {
+    G->HaveLastCells = 0;
+    return;
+  }
+  // (A different Count is caught as well, for callers which do not call
+  // ForgetLastCells.)
+  if (Count != G->Count || Width != G->Width || Height != G->Height)
+    G->HaveLastCells = 0;
+  G->Count = Count;
+  G->Width = Width;
+  G->Height = Height;
+  if (++G->Step == 0)
+    G->Step = 1;
+
+  BucketPoints(G, X, Y, Count);
+
+  // 1. Points sharing a cell, two at a time. Going through the buckets in
+  // order, each point is paired with the next one of its bucket in the
+  // same cell (if neither has bounced yet).
+  for (k = 0; k < (uint32_t)Count; ++k) {
+    A = G->Order[k];
+    if (G->Bounced[A] == G->Step)
+      continue;
+    End = G->Start[CellBucket(G, G->Cell[A]) + 1];
+    for (j = k + 1; j < End; ++j) {
+      B = G->Order[j];
+      if (G->Cell[B] == G->Cell[A] && G->Bounced[B] != G->Step) {
+        BouncePoints(G, X, Y, dX, dY, A, B, 3);
+        G->Shared++;
+        break;
+      }
+    }
+  }
+
+  // 2. Points which crossed: A went from (BeforeX, BeforeY) to (AfterX,
+  // AfterY), and B either the other way around (they swapped cells), or
+  // across the same 2 x 2 cells with only X (or Y) the other way around
+  // (their paths make an X).
+  if (G->HaveLastCells) {
+    for (i = 0; i < Count; ++i) {
+      A = i;
+      Before = G->LastCell[A];
+      if (Before == G->Cell[A] || G->Bounced[A] == G->Step)
+        continue;
+      BeforeX = Before % Width, BeforeY = Before / Width;
+      AfterX = G->Cell[A] % Width, AfterY = G->Cell[A] / Width;
+      if (FindCrossing(G, Before, G->Cell[A], &B))
+        Axes = 3;
+      else if (BeforeX != AfterX && BeforeY != AfterY &&
+               FindCrossing(G, AfterY * Width + BeforeX, BeforeY * Width + AfterX, &B))
+        Axes = 1;
+      else if (BeforeX != AfterX && BeforeY != AfterY &&
+               FindCrossing(G, BeforeY * Width + AfterX, AfterY * Width + BeforeX, &B))
+        Axes = 2;
+      else
+        continue;
+      // Meet half way: both go back along the axes they crossed on.
+      if (Axes & 1)
+        Tmp = X[A], X[A] = X[B], X[B] = Tmp;
+      if (Axes & 2)
+        Tmp = Y[A], Y[A] = Y[B], Y[B] = Tmp;
+      G->Cell[A] = PointCell(G, X[A], Y[A]);
+      G->Cell[B] = PointCell(G, X[B], Y[B]);
+      BouncePoints(G, X, Y, dX, dY, A, B, Axes);
+      G->Crossed++;
+    }
+  }
+  G->HaveLastCells = 1;
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "framescheduler.h"
+
+// The EventLoop runs an animation loop on a single thread, with epoll:
+//
+// 1. SIGINT, SIGTERM and SIGWINCH are blocked, and read from a signalfd,
+//    so no signal handler runs in the middle of the frame (the terminal
+//    is resized between frames, where it is safe to print).
+// 2. The frame ticks come from a timerfd, armed at the absolute deadline
+//    of the FrameScheduler.
+// 3. Input file descriptors (e.g., /dev/KEYSW) and stdin are watched for
+//    readiness.
+//
+// WaitForEvents() sleeps in epoll_wait until one of them is ready, and
+// returns what happened as a mask of EVENT_* bits; the process is not
+// woken up otherwise.
+//
+// The signals must be blocked before any thread is created (the threads
+// inherit the mask), so start the loop first thing in main().
+
+#define EVENT_FRAME 1  // The next frame is due (see Steps)
+#define EVENT_RESIZE 2 // The terminal was resized
+#define EVENT_QUIT 4   // SIGINT or SIGTERM, or 'q' on stdin
+#define EVENT_INPUT 8  // An input file descriptor is readable
+
+// Largest number of events handled per epoll_wait.
+#define MAX_LOOP_EVENTS 8
+
+struct EventLoop {
+  int EpollFD;
+  int SignalFD;
+  int TimerFD;
+  int InputFD; // stdin, while it is watched (-1 otherwise)
+};
+
+struct EventLoop Loop = {.EpollFD = -1, .SignalFD = -1, .TimerFD = -1, .InputFD = -1};
+
+// Watch FD: the epoll data of each file descriptor is the EVENT_* bit it
+// raises. Returns 0 if it cannot be watched (e.g., a regular file).
+int AddEventSource(struct EventLoop *L, int FD, uint32_t Event) {
+  struct epoll_event E = {.events = EPOLLIN, .data.u32 = Event};
+  return FD >= 0 && epoll_ctl(L->EpollFD, EPOLL_CTL_ADD, FD, &E) == 0;
+}
+
+void RemoveEventSource(struct EventLoop *L, int FD) {
+  epoll_ctl(L->EpollFD, EPOLL_CTL_DEL, FD, NULL);
+}
+
+// Internal bits, which WaitForEvents() turns into EVENT_* bits.
+#define SOURCE_SIGNAL (1u << 30)
+#define SOURCE_TIMER (1u << 29)
+#define SOURCE_STDIN (1u << 28)
+
+// Block the signals, and create the signalfd, the timerfd and the epoll
+// instance. Returns 0 on failure (with errno set).
+int StartEventLoop(struct EventLoop *L) {
+  sigset_t Signals;
+
+  sigemptyset(&Signals);
+  sigaddset(&Signals, SIGINT);
+  sigaddset(&Signals, SIGTERM);
+  sigaddset(&Signals, SIGWINCH);
+  if (sigprocmask(SIG_BLOCK, &Signals, NULL))
+    return 0;
+
+  L->EpollFD = epoll_create1(EPOLL_CLOEXEC);
+  L->SignalFD = signalfd(-1, &Signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  L->TimerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (L->EpollFD == -1 || L->SignalFD == -1 || L->TimerFD == -1)
+    return 0;
+  if (!AddEventSource(L, L->SignalFD, SOURCE_SIGNAL) ||
+      !AddEventSource(L, L->TimerFD, SOURCE_TIMER))
+    return 0;
+
+  // stdin is only watched if epoll can (it cannot watch /dev/null or a
+  // regular file, which would never have anything to say anyway).
+  if (AddEventSource(L, STDIN_FILENO, SOURCE_STDIN))
+    L->InputFD = STDIN_FILENO;
+  return 1;
+}
+
+// Read the pending signals.
+uint32_t TakeSignals(struct EventLoop *L) {
+  struct signalfd_siginfo Info;
+  uint32_t Events = 0;
+
+  while (read(L->SignalFD, &Info, sizeof(Info)) == sizeof(Info)) {
+    if (Info.ssi_signo == SIGWINCH)
+      Events |= EVENT_RESIZE;
+    else
+      Events |= EVENT_QUIT;
+  }
+  return Events;
+}
+
+// Read what was typed: 'q' quits. At the end of stdin, stop watching it.
+uint32_t TakeStdin(struct EventLoop *L) {
+  char Buffer[64];
+  ssize_t BytesRead = read(L->InputFD, Buffer, sizeof(Buffer));
+
+  if (BytesRead <= 0) {
+    if (BytesRead == 0 || errno != EAGAIN) {
+      RemoveEventSource(L, L->InputFD);
+      L->InputFD = -1;
+    }
+    return 0;
+  }
+  return memchr(Buffer, 'q', BytesRead) ? EVENT_QUIT : 0;
+}
+
+// Wait until the next frame of S is due, or anything else happens.
+// Returns the EVENT_* bits of what happened. With EVENT_FRAME, *Steps
+// is the number of simulation steps to run before drawing the frame
+// (otherwise it is 0, and the frame is still due at the same deadline).
+uint32_t WaitForEvents(struct EventLoop *L, struct FrameScheduler *S, int *Steps) {
+  struct epoll_event Ready[MAX_LOOP_EVENTS];
+  struct itimerspec Due = {{0, 0}, {0, 0}};
+  uint64_t Expirations;
+  uint32_t Events = 0;
+  long long Now = NowNs();
+  int Count, i;
+
+  *Steps = 0;
+  // A late frame is due at once. Disarming the timer drops any tick we
+  // have not read (e.g., when we were woken up for input).
+  if (Now > S->Deadline) {
+    timerfd_settime(L->TimerFD, 0, &Due, NULL);
+    FrameOverrun(S, Now);
+    *Steps = StartNextFrame(S);
+    return EVENT_FRAME;
+  }
+
+  // (Re)arm the timer every time: the period may have changed since.
+  Due.it_value.tv_sec = S->Deadline / NS_PER_SEC;
+  Due.it_value.tv_nsec = S->Deadline % NS_PER_SEC;
+  timerfd_settime(L->TimerFD, TFD_TIMER_ABSTIME, &Due, NULL);
+
+  while ((Count = epoll_wait(L->EpollFD, Ready, MAX_LOOP_EVENTS, -1)) == -1 && errno == EINTR)
+    ;
+  for (i = 0; i < Count; ++i) {
+    switch (Ready[i].data.u32) {
+    case SOURCE_SIGNAL:
+      Events |= TakeSignals(L);
+      break;
+    case SOURCE_TIMER:
+      if (read(L->TimerFD, &Expirations, sizeof(Expirations)) == sizeof(Expirations)) {
+        S->FrameTime = S->Deadline;
+        *Steps = StartNextFrame(S);
+        Events |= EVENT_FRAME;
+      }
+      break;
+    case SOURCE_STDIN:
+      Events |= TakeStdin(L);
+      break;
+    default:
+      Events |= Ready[i].data.u32;
+    }
+  }
+  return Events;
+}
+
+// The signals stay blocked: one arriving now should not cut the cleanup
+// short.
+void StopEventLoop(struct EventLoop *L) {
+  if (L->EpollFD != -1)
+    close(L->EpollFD);
+  if (L->SignalFD != -1)
+    close(L->SignalFD);
+  if (L->TimerFD != -1)
+    close(L->TimerFD);
+  *L = (struct EventLoop){.EpollFD = -1, .SignalFD = -1, .TimerFD = -1, .InputFD = -1};
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef __FOOTPRINT_H__
+#define __FOOTPRINT_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A Footprint records which cells of the frame were drawn, so that they
+// can be erased later without rasterizing everything again.
+//
+// Every cell has a stamp holding the number of the last frame which drew
+// it, so a cell is only recorded once per frame however many lines cross
+// it. Retiring a frame (NextFootprint) turns its cells into the pending
+// erase, and starts a new frame. The pending cells which the new frame
+// draws again keep their (new) stamp, so erasing skips them.
+//
+// Cells are recorded in one list per drawing thread (each cell belongs to
+// a single thread while a frame is drawn, see tileraster.h), so recording
+// needs no locking.
+
+#define FOOTPRINT_LISTS 64
+
+struct FootprintList {
+  uint32_t *Cells; // Index of each cell (Y * Width + X, from 0)
+  int Count;
+  int Capacity;
+};
+
+struct Footprint {
+  int Recording;      // Set to record the cells that are drawn
+  uint32_t *Stamp;    // Last frame that drew each cell
+  size_t NumCells;    // Number of cells in the frame
+  uint32_t Frame;     // Number of the frame being drawn (never 0)
+  int Overflow;       // Set if a list could not be grown
+  int PendingOverflow;
+
+  struct FootprintList Drawn[FOOTPRINT_LISTS];   // Cells of this frame
+  struct FootprintList Pending[FOOTPRINT_LISTS]; // Cells still to be erased
+};
+
+struct Footprint Footprint = {.Frame = 1};
+
+// Forget every recorded cell, and size the stamps for a frame of NumCells
+// cells. Returns 0 if the stamps could not be allocated (recording is
+// then turned off).
+int ResizeFootprint(struct Footprint *F, size_t NumCells) {
+  int i;
+  uint32_t *Stamp;
+
+  for (i = 0; i < FOOTPRINT_LISTS; ++i) {
+    F->Drawn[i].Count = 0;
+    F->Pending[i].Count = 0;
+  }
+  F->Frame = 1;
+  F->Overflow = 0;
+  F->PendingOverflow = 0;
+  if (!F->Recording)
+    return 1;
+
+  Stamp = (uint32_t *)calloc(NumCells, sizeof(uint32_t));
+  if (!Stamp) {
+    F->Recording = 0;
+    return 0;
+  }
+  free(F->Stamp);
+  F->Stamp = Stamp;
+  F->NumCells = NumCells;
+  return 1;
+}
+
+// Record that Cell was drawn by the thread owning List.
+void RecordCell(struct Footprint *F, int List, uint32_t Cell) {
+  struct FootprintList *L = &F->Drawn[List];
+  uint32_t *Grown;
+  int NewCapacity;
+
+  if (F->Stamp[Cell] == F->Frame)
+    return;
+  F->Stamp[Cell] = F->Frame;
+
+  if (L->Count == L->Capacity) {
+    NewCapacity = L->Capacity ? L->Capacity << 1 : 256;
+    Grown = (uint32_t *)realloc(L->Cells, sizeof(uint32_t) * NewCapacity);
+    if (!Grown) {
+      // The erase will have to look at every cell instead.
+      F->Overflow = 1;
+      return;
+    }
+    L->Cells = Grown;
+    L->Capacity = NewCapacity;
+  }
+  L->Cells[L->Count++] = Cell;
+}
+
+// Returns 1 if Cell has been drawn during the current frame.
+int DrawnThisFrame(struct Footprint *F, uint32_t Cell) {
+  return F->Stamp[Cell] == F->Frame;
+}
+
+// The current frame is done: its cells become the pending erase (replacing
+// any erase that was never carried out), and a new frame starts.
+void NextFootprint(struct Footprint *F) {
+  int i;
+  struct FootprintList Tmp;
+
+  for (i = 0; i < FOOTPRINT_LISTS; ++i) {
+    Tmp = F->Pending[i];
+    F->Pending[i] = F->Drawn[i];
+    F->Drawn[i] = Tmp;
+    F->Drawn[i].Count = 0;
+  }
+  F->PendingOverflow = F->Overflow;
+  F->Overflow = 0;
+
+  // After 2^32 frames, the stamps start over.
+  if (++F->Frame == 0) {
+    memset(F->Stamp, 0, sizeof(uint32_t) * F->NumCells);
+    F->Frame = 1;
+  }
+}
+
+// Start (or stop) recording, for a frame of NumCells cells.
+void RecordFootprint(struct Footprint *F, int Recording, size_t NumCells) {
+  F->Recording = Recording;
+  ResizeFootprint(F, NumCells);
+}
+
+void ReleaseFootprint(struct Footprint *F) {
+  int i;
+  for (i = 0; i < FOOTPRINT_LISTS; ++i) {
+    free(F->Drawn[i].Cells);
+    free(F->Pending[i].Cells);
+  }
+  free(F->Stamp);
+  memset(F, 0, sizeof(*F));
+  F->Frame = 1;
+}
+
+#endif
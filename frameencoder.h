@@ -0,0 +1,326 @@
+#ifndef __FRAME_ENCODER_H__
+#define __FRAME_ENCODER_H__
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The FrameEncoder builds a whole frame of VT100 output into one
+// contiguous buffer, which is then sent with a single write(2).
+//
+// While encoding, it keeps track of where the terminal's cursor is and
+// which color is selected, so that:
+// 1. Consecutive cells need no cursor movement at all,
+// 2. The cheapest of an absolute move (CUP), a relative move
+//    (CUU/CUD/CUF/CUB) or CR/LF is used otherwise, and
+// 3. A color is only sent when it differs from the current one.
+//
+// Runs of blank cells can also be erased without sending a space for
+// every cell (see EncodeEraseChars and EncodeEraseLine).
+
+#define ENCODER_INITIAL_BYTES 4096
+
+// Cursor coordinate used when we do not know where the cursor is.
+#define CURSOR_UNKNOWN 0
+// Color used when we do not know which color the terminal has selected.
+#define COLOR_UNKNOWN -1
+
+struct FrameEncoder {
+  char *Buffer;    // Bytes of the frame being encoded
+  size_t Size;     // Number of bytes encoded so far
+  size_t Capacity; // Allocated size of Buffer
+  int Width;       // Width of the terminal (in cells)
+  int Height;      // Height of the terminal (in cells)
+  int CursorX;     // Column of the cursor (or CURSOR_UNKNOWN)
+  int CursorY;     // Row of the cursor (or CURSOR_UNKNOWN)
+  int Color;       // Selected color (or COLOR_UNKNOWN)
+  int OutputFD;    // Where finished frames are written
+  int Failed;      // Part of the frame could not be encoded (out of memory)
+  int LastFrameLost; // The last frame did not reach the terminal completely
+
+  // Statistics
+  size_t LastFrameBytes;         // Bytes sent for the last frame
+  unsigned long long TotalBytes; // Bytes sent for all frames
+  unsigned long Frames;          // Number of frames sent
+};
+
+struct FrameEncoder Encoder = {.Buffer = NULL,
+                               .Size = 0,
+                               .Capacity = 0,
+                               .CursorX = CURSOR_UNKNOWN,
+                               .CursorY = CURSOR_UNKNOWN,
+                               .Color = COLOR_UNKNOWN,
+                               .OutputFD = STDOUT_FILENO};
+
+// Make sure there is room for Bytes more bytes in the buffer.
+// Returns 0 if the buffer could not be grown.
+int EncoderReserve(struct FrameEncoder *Enc, size_t Bytes) {
+  size_t NewCapacity;
+  char *NewBuffer;
+
+  if (Enc->Size + Bytes <= Enc->Capacity)
+    return 1;
+
+  NewCapacity = Enc->Capacity ? Enc->Capacity : ENCODER_INITIAL_BYTES;
+  while (NewCapacity < Enc->Size + Bytes)
+    NewCapacity <<= 1;
+
+  NewBuffer = (char *)realloc(Enc->Buffer, NewCapacity);
+  if (!NewBuffer)
+    return 0;
+  Enc->Buffer = NewBuffer;
+  Enc->Capacity = NewCapacity;
+  return 1;
+}
+
+// A frame missing a piece could end in the middle of an escape sequence,
+// so it is not sent at all (see EncoderFlush).
+void EncodeBytes(struct FrameEncoder *Enc, const char *Bytes, size_t Length) {
+  if (!EncoderReserve(Enc, Length)) {
+    Enc->Failed = 1;
+    return;
+  }
+  memcpy(&Enc->Buffer[Enc->Size], Bytes, Length);
+  Enc->Size += Length;
+}
+
+// Append an escape sequence of the form "\e[<N><Final>".
+// N is omitted when it is 1 (the default for all of the
+// sequences we use).
+void EncodeCSI(struct FrameEncoder *Enc, int N, char Final) {
+  char Seq[16];
+  int Length;
+  if (N == 1)
+    Length = snprintf(Seq, sizeof(Seq), "\e[%c", Final);
+  else
+    Length = snprintf(Seq, sizeof(Seq), "\e[%d%c", N, Final);
+  EncodeBytes(Enc, Seq, Length);
+}
+
+// Number of decimal digits in N (N > 0)
+int DigitsIn(int N) {
+  int Digits = 1;
+  while (N >= 10) {
+    N /= 10;
+    Digits++;
+  }
+  return Digits;
+}
+
+// Number of bytes needed by "\e[<N><Final>"
+int CSICost(int N) { return N == 1 ? 3 : 3 + DigitsIn(N); }
+
+// Number of bytes needed by an absolute move to (X, Y).
+int AbsoluteMoveCost(int X, int Y) {
+  if (X == 1)
+    return CSICost(Y); // "\e[YH"
+  return 4 + DigitsIn(Y) + DigitsIn(X); // "\e[Y;XH"
+}
+
+// Number of bytes needed to move horizontally from column
+// From to column To (on the same row).
+int HorizontalMoveCost(int From, int To) {
+  int Cost;
+  if (From == To)
+    return 0;
+  if (To == 1)
+    return 1; // "\r"
+  Cost = CSICost(From < To ? To - From : From - To);
+  // "\r" followed by a forward move may be cheaper.
+  if (1 + CSICost(To - 1) < Cost)
+    Cost = 1 + CSICost(To - 1);
+  return Cost;
+}
+
+// Number of bytes needed to move the cursor to (X, Y).
+// Returns the cost of the cheapest move. Used by the caller to decide if
+// re-sending cells is cheaper than skipping over them.
+int MoveCost(struct FrameEncoder *Enc, int X, int Y) {
+  int Cost;
+  int Relative;
+
+  if (Enc->CursorX == X && Enc->CursorY == Y)
+    return 0;
+  Cost = AbsoluteMoveCost(X, Y);
+  if (Enc->CursorX == CURSOR_UNKNOWN || Enc->CursorY == CURSOR_UNKNOWN)
+    return Cost;
+
+  if (Enc->CursorY == Y) {
+    Relative = HorizontalMoveCost(Enc->CursorX, X);
+  } else if (Y == Enc->CursorY + 1) {
+    // "\r\n" takes us to the start of the next line.
+    Relative = 2 + HorizontalMoveCost(1, X);
+  } else {
+    Relative = CSICost(Y > Enc->CursorY ? Y - Enc->CursorY : Enc->CursorY - Y) +
+               HorizontalMoveCost(Enc->CursorX, X);
+  }
+  return Relative < Cost ? Relative : Cost;
+}
+
+// Append the horizontal part of a relative move.
+void EncodeHorizontalMove(struct FrameEncoder *Enc, int From, int To) {
+  if (From == To)
+    return;
+  if (To == 1) {
+    EncodeBytes(Enc, "\r", 1);
+    return;
+  }
+  if (1 + CSICost(To - 1) < CSICost(From < To ? To - From : From - To)) {
+    EncodeBytes(Enc, "\r", 1);
+    From = 1;
+  }
+  if (From < To)
+    EncodeCSI(Enc, To - From, 'C');
+  else
+    EncodeCSI(Enc, From - To, 'D');
+}
+
+// Move the cursor to (X, Y) using the cheapest sequence available.
+void EncodeMoveTo(struct FrameEncoder *Enc, int X, int Y) {
+  char Seq[24];
+  int Length;
+  int Cost;
+
+  if (Enc->CursorX == X && Enc->CursorY == Y)
+    return;
+
+  Cost = MoveCost(Enc, X, Y);
+  if (Enc->CursorX == CURSOR_UNKNOWN || Enc->CursorY == CURSOR_UNKNOWN ||
+      Cost == AbsoluteMoveCost(X, Y)) {
+    if (X == 1)
+      Length = snprintf(Seq, sizeof(Seq), "\e[%dH", Y);
+    else
+      Length = snprintf(Seq, sizeof(Seq), "\e[%d;%dH", Y, X);
+    EncodeBytes(Enc, Seq, Length);
+  } else if (Enc->CursorY == Y) {
+    EncodeHorizontalMove(Enc, Enc->CursorX, X);
+  } else if (Y == Enc->CursorY + 1 && Cost == 2 + HorizontalMoveCost(1, X)) {
+    EncodeBytes(Enc, "\r\n", 2);
+    EncodeHorizontalMove(Enc, 1, X);
+  } else {
+    if (Y > Enc->CursorY)
+      EncodeCSI(Enc, Y - Enc->CursorY, 'B');
+    else
+      EncodeCSI(Enc, Enc->CursorY - Y, 'A');
+    EncodeHorizontalMove(Enc, Enc->CursorX, X);
+  }
+  Enc->CursorX = X;
+  Enc->CursorY = Y;
+}
+
+// Select a color, unless it is already selected.
+void EncodeColor(struct FrameEncoder *Enc, int Color) {
+  char Seq[8];
+  if (Enc->Color == Color)
+    return;
+  // NOTE: Unlike the cursor moves, "\e[m" is not "\e[1m", so the
+  // parameter is always sent.
+  EncodeBytes(Enc, Seq, snprintf(Seq, sizeof(Seq), "\e[%dm", Color));
+  Enc->Color = Color;
+}
+
+// Write a character at the cursor, and advance the cursor.
+void EncodeChar(struct FrameEncoder *Enc, char C) {
+  EncodeBytes(Enc, &C, 1);
+  // Writing in the last column leaves the cursor in a "pending wrap"
+  // state, where relative moves are not reliable.
+  if (Enc->CursorX == CURSOR_UNKNOWN)
+    return;
+  if (Enc->CursorX >= Enc->Width)
+    Enc->CursorX = Enc->CursorY = CURSOR_UNKNOWN;
+  else
+    Enc->CursorX++;
+}
+
+// Erase Count cells starting at the cursor (ECH). The cursor does not move.
+void EncodeEraseChars(struct FrameEncoder *Enc, int Count) {
+  EncodeCSI(Enc, Count, 'X');
+}
+
+// Erase from the cursor to the end of the line (EL). The cursor does not move.
+void EncodeEraseLine(struct FrameEncoder *Enc) { EncodeBytes(Enc, "\e[K", 3); }
+
+// Start encoding a new frame for a terminal of the given size.
+// We cannot know whether anything moved the cursor since the last
+// frame, so the first move of every frame is absolute.
+void EncoderBegin(struct FrameEncoder *Enc, int Width, int Height) {
+  Enc->Size = 0;
+  Enc->Failed = 0;
+  Enc->Width = Width;
+  Enc->Height = Height;
+  Enc->CursorX = CURSOR_UNKNOWN;
+  Enc->CursorY = CURSOR_UNKNOWN;
+}
+
+// Forget the terminal state (e.g., after the terminal was reset).
+void EncoderInvalidate(struct FrameEncoder *Enc) {
+  Enc->CursorX = CURSOR_UNKNOWN;
+  Enc->CursorY = CURSOR_UNKNOWN;
+  Enc->Color = COLOR_UNKNOWN;
+}
+
+// Wait until FD can take more bytes (after a write(2) to a non-blocking
+// terminal failed with EAGAIN). Returns 0 if it never will.
+int WaitWritable(int FD) {
+  struct pollfd Poll = {.fd = FD, .events = POLLOUT};
+  while (poll(&Poll, 1, -1) < 0) {
+    if (errno != EINTR)
+      return 0;
+  }
+  return !(Poll.revents & (POLLERR | POLLHUP | POLLNVAL));
+}
+
+// Send the encoded frame with a single write(2) (only repeated if the
+// kernel accepts part of the frame, or if a signal interrupts us).
+// A frame which could not be encoded completely is dropped instead, and
+// the encoder forgets the terminal state.
+// Returns the number of bytes sent. LastFrameLost is set if the frame
+// was dropped, or only part of it could be written: the terminal then
+// does not show what the caller encoded.
+size_t EncoderFlush(struct FrameEncoder *Enc) {
+  size_t Sent = 0;
+  ssize_t Status;
+
+  if (Enc->Failed) {
+    Enc->Failed = 0;
+    Enc->Size = 0;
+    EncoderInvalidate(Enc);
+    Enc->LastFrameBytes = 0;
+    Enc->LastFrameLost = 1;
+    return 0;
+  }
+
+  // Anything printed through stdio must reach the terminal first.
+  fflush(stdout);
+
+  while (Sent < Enc->Size) {
+    Status = write(Enc->OutputFD, &Enc->Buffer[Sent], Enc->Size - Sent);
+    if (Status < 0) {
+      if (errno == EINTR || (errno == EAGAIN && WaitWritable(Enc->OutputFD)))
+        continue;
+      break;
+    }
+    Sent += Status;
+  }
+
+  Enc->LastFrameLost = Sent < Enc->Size;
+  if (Enc->LastFrameLost)
+    EncoderInvalidate(Enc);
+  Enc->LastFrameBytes = Sent;
+  Enc->TotalBytes += Sent;
+  Enc->Frames++;
+  Enc->Size = 0;
+  return Sent;
+}
+
+void ReleaseEncoder(struct FrameEncoder *Enc) {
+  free(Enc->Buffer);
+  Enc->Buffer = NULL;
+  Enc->Size = 0;
+  Enc->Capacity = 0;
+}
+
+#endif
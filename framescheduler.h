@@ -0,0 +1,124 @@
+#ifndef __FRAME_SCHEDULER_H__
+#define __FRAME_SCHEDULER_H__
+
+#include <stdio.h>
+#include <time.h>
+
+// The FrameScheduler paces an animation loop with absolute deadlines on
+// CLOCK_MONOTONIC, rather than sleeping for a fixed time after the work:
+//
+// 1. Frame k is due at Start + k * Period, whatever the time spent on
+//    drawing and output, so the frame rate does not drift with load.
+// 2. A signal (e.g., SIGWINCH) interrupting the sleep just resumes
+//    sleeping until the same deadline.
+// 3. A frame that is late is counted as an overrun, and any frames that
+//    were missed entirely are skipped (instead of being rushed out).
+//
+// The simulation runs on its own fixed time step: StartNextFrame()
+// returns how many steps have come due by the frame's deadline, so the
+// animation keeps the same speed when frames are late (or when the frame
+// period and the step are set apart).
+//
+// Changing the period (SetSchedulerPeriod) moves the next deadline
+// relative to the last one, so retuning does not accumulate any error.
+//
+// The scheduler does not sleep by itself: WaitForEvents (eventloop.h)
+// waits for the deadline, along with the input and the signals.
+
+#define NS_PER_SEC 1000000000LL
+
+// At most this many simulation steps are run to catch up after a stall.
+// Any time beyond that is dropped.
+#define MAX_CATCHUP_STEPS 8
+
+struct FrameScheduler {
+  long long PeriodNs;   // Time between two frames
+  long long StepNs;     // Time simulated by one simulation step
+  long long FrameTime;  // Deadline of the last frame (or when it started, if late)
+  long long Deadline;   // Deadline of the next frame
+  long long SimTime;    // Time simulated so far
+
+  // Statistics
+  unsigned long Frames;     // Number of frames scheduled
+  unsigned long Overruns;   // Frames which missed their deadline
+  unsigned long Skipped;    // Frames skipped to catch up
+  unsigned long long Steps; // Simulation steps run
+  long long WorstLateNs;    // Largest time a frame was late by
+};
+
+struct FrameScheduler Scheduler = {0};
+
+// Current time on the monotonic clock, in nanoseconds.
+long long NowNs() {
+  struct timespec T;
+  clock_gettime(CLOCK_MONOTONIC, &T);
+  return (long long)T.tv_sec * NS_PER_SEC + T.tv_nsec;
+}
+
+// Start scheduling frames PeriodNs apart (and one simulation step per
+// frame), with the first deadline one period from now.
+void StartScheduler(struct FrameScheduler *S, long long PeriodNs) {
+  long long Now = NowNs();
+  *S = (struct FrameScheduler){0};
+  S->PeriodNs = PeriodNs;
+  S->StepNs = PeriodNs;
+  S->FrameTime = Now;
+  S->SimTime = Now;
+  S->Deadline = Now + PeriodNs;
+}
+
+// Change the time between frames. The next deadline becomes one (new)
+// period after the last one.
+void SetSchedulerPeriod(struct FrameScheduler *S, long long PeriodNs) {
+  S->PeriodNs = PeriodNs;
+  S->Deadline = S->FrameTime + PeriodNs;
+}
+
+// Change the time simulated by one step. The simulated time is kept,
+// so no partial step is lost.
+void SetSimulationStep(struct FrameScheduler *S, long long StepNs) {
+  S->StepNs = StepNs;
+}
+
+// The next frame is late (it is Now): count the overrun, and skip the
+// frames we missed entirely, staying on the grid of deadlines.
+void FrameOverrun(struct FrameScheduler *S, long long Now) {
+  long long Late = Now - S->Deadline;
+  long long Missed;
+
+  S->Overruns++;
+  if (Late > S->WorstLateNs)
+    S->WorstLateNs = Late;
+  Missed = Late / S->PeriodNs;
+  S->Skipped += Missed;
+  S->Deadline += Missed * S->PeriodNs;
+  S->FrameTime = Now;
+}
+
+// Start the frame whose deadline has come. Returns the number of
+// simulation steps to run before drawing it.
+int StartNextFrame(struct FrameScheduler *S) {
+  int Steps;
+
+  S->Deadline += S->PeriodNs;
+  S->Frames++;
+
+  // Run the simulation up to the time of this frame.
+  Steps = (S->FrameTime - S->SimTime) / S->StepNs;
+  if (Steps > MAX_CATCHUP_STEPS) {
+    S->SimTime = S->FrameTime - (S->FrameTime - S->SimTime) % S->StepNs;
+    Steps = MAX_CATCHUP_STEPS;
+  } else {
+    S->SimTime += Steps * S->StepNs;
+  }
+  S->Steps += Steps;
+  return Steps;
+}
+
+// Print the statistics of the scheduler.
+void ReportScheduler(struct FrameScheduler *S, FILE *Out) {
+  fprintf(Out, "Frames: %lu, overruns: %lu (worst %.3f ms late), skipped: %lu, steps: %llu\n",
+          S->Frames, S->Overruns, S->WorstLateNs / 1e6, S->Skipped, S->Steps);
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef __FRAME_STATS_H__
+#define __FRAME_STATS_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framescheduler.h"
+
+// FrameStats measures where the time of a frame goes.
+//
+// The animation loop brackets each of its phases with BeginPhase/EndPhase
+// and the time spent is added to a latency histogram for that phase.
+// PresentFrame also records the bytes written and the cells sent (or
+// erased) for every frame (frames skipped because the output was busy
+// are only counted, see CountSkippedFrame), and part 5 records the time
+// from every KEY press to the frame which shows it.
+//
+// The histograms have fixed buckets: the exact value below 16, and then
+// 8 buckets for every power of two (so a bucket is at most 12.5% wide).
+// Recording a value is a couple of shifts and an increment, and nothing
+// is allocated once the stats are started.
+//
+// The stats are off unless the FRAME_STATS environment variable is set,
+// to the file that the summary (p50/p99/max of every histogram, and the
+// frame rate) is written to on exit ("-" for stderr). If
+// FRAME_STATS_INTERVAL is set as well, a summary is also appended every
+// that many seconds.
+
+#define PHASE_INPUT 0
+#define PHASE_SIMULATE 1
+#define PHASE_RASTERIZE 2
+#define PHASE_ENCODE 3
+#define PHASE_WRITE 4
+#define PHASE_SLEEP 5
+#define PHASE_ERASE 6 // The erase queued by ClearPointLoop (see EraseFootprint)
+#define NUM_PHASES 7
+
+const char *PhaseNames[NUM_PHASES] = {"input", "simulate", "rasterize", "encode",
+                                      "write", "sleep", "erase"};
+
+#define HISTOGRAM_EXACT 16
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKETS (HISTOGRAM_EXACT + (64 - 4) * (1 << HISTOGRAM_SUB_BITS))
+
+struct Histogram {
+  uint64_t Buckets[HISTOGRAM_BUCKETS];
+  uint64_t Count;
+  uint64_t Sum;
+  uint64_t Max;
+};
+
+struct FrameStats {
+  int Enabled;
+  FILE *Out;            // Where the summaries are written
+  long long Start;      // When the stats were started
+  long long IntervalNs; // Time between periodic summaries (0 for none)
+  long long LastReport; // When the last periodic summary was written
+
+  long long PhaseStart[NUM_PHASES];
+  struct Histogram Phases[NUM_PHASES]; // Nanoseconds spent in each phase
+  struct Histogram Bytes;              // Bytes written per frame
+  struct Histogram Cells;              // Cells sent (or erased) per frame
+  struct Histogram Latency;            // Nanoseconds from a KEY press to its frame
+  uint64_t Skipped;                    // Frames skipped (not in Bytes or Cells)
+};
+
+struct FrameStats Stats = {0};
+
+// Bucket of value V.
+int HistogramBucket(uint64_t V) {
+  int Msb;
+  if (V < HISTOGRAM_EXACT)
+    return V;
+  Msb = 63 - __builtin_clzll(V);
+  return HISTOGRAM_EXACT + ((Msb - 4) << HISTOGRAM_SUB_BITS) +
+         ((V >> (Msb - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+// Largest value that falls in bucket B.
+uint64_t BucketLimit(int B) {
+  int Msb, Sub;
+  if (B < HISTOGRAM_EXACT)
+    return B;
+  Msb = ((B - HISTOGRAM_EXACT) >> HISTOGRAM_SUB_BITS) + 4;
+  Sub = (B - HISTOGRAM_EXACT) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+  return (((uint64_t)((1 << HISTOGRAM_SUB_BITS) + Sub + 1)) << (Msb - HISTOGRAM_SUB_BITS)) - 1;
+}
+
+void RecordValue(struct Histogram *H, uint64_t V) {
+  H->Buckets[HistogramBucket(V)]++;
+  H->Count++;
+  H->Sum += V;
+  if (V > H->Max)
+    H->Max = V;
+}
+
+// Value below which a fraction Q of the recorded values fall (rounded up
+// to the end of its bucket, but never above the largest value).
+uint64_t Percentile(struct Histogram *H, double Q) {
+  uint64_t Seen = 0;
+  uint64_t Rank;
+  uint64_t Limit;
+  int B;
+
+  if (!H->Count)
+    return 0;
+  Rank = (uint64_t)(Q * H->Count);
+  if (Rank >= H->Count)
+    Rank = H->Count - 1;
+  for (B = 0; B < HISTOGRAM_BUCKETS; ++B) {
+    Seen += H->Buckets[B];
+    if (Seen > Rank)
+      break;
+  }
+  Limit = BucketLimit(B);
+  return Limit < H->Max ? Limit : H->Max;
+}
+
+// Start the stats if FRAME_STATS is set.
+void StartFrameStats() {
+  char *Path = getenv("FRAME_STATS");
+  char *Interval = getenv("FRAME_STATS_INTERVAL");
+
+  memset(&Stats, 0, sizeof(Stats));
+  if (!Path || !*Path)
+    return;
+  Stats.Out = strcmp(Path, "-") ? fopen(Path, "w") : stderr;
+  if (!Stats.Out)
+    return;
+  Stats.Enabled = 1;
+  Stats.Start = Stats.LastReport = NowNs();
+  if (Interval)
+    Stats.IntervalNs = (long long)(atof(Interval) * NS_PER_SEC);
+}
+
+void BeginPhase(int Phase) {
+  if (Stats.Enabled)
+    Stats.PhaseStart[Phase] = NowNs();
+}
+
+void EndPhase(int Phase) {
+  if (Stats.Enabled)
+    RecordValue(&Stats.Phases[Phase], NowNs() - Stats.PhaseStart[Phase]);
+}
+
+// Record the output of one frame.
+void CountFrame(size_t Bytes, int Cells) {
+  if (!Stats.Enabled)
+    return;
+  RecordValue(&Stats.Bytes, Bytes);
+  RecordValue(&Stats.Cells, Cells);
+}
+
+// Record a frame which was skipped, rather than as one of 0 bytes.
+void CountSkippedFrame() {
+  if (Stats.Enabled)
+    Stats.Skipped++;
+}
+
+// Record that a frame showing an input given at time Time is out.
+void CountInput(long long Time) {
+  if (Stats.Enabled)
+    RecordValue(&Stats.Latency, NowNs() - Time);
+}
+
+void ReportHistogram(FILE *Out, const char *Name, const char *Unit,
+                     struct Histogram *H, double Scale) {
+  fprintf(Out, "  %-10s %10llu %12.3f %12.3f %12.3f %12.3f  %s\n", Name,
+          (unsigned long long)H->Count, H->Count ? H->Sum * Scale / H->Count : 0,
+          Percentile(H, 0.5) * Scale, Percentile(H, 0.99) * Scale, H->Max * Scale, Unit);
+}
+
+// Write a summary of everything recorded so far.
+void ReportFrameStats(FILE *Out) {
+  int i;
+  double Seconds = (NowNs() - Stats.Start) / (double)NS_PER_SEC;
+
+  fprintf(Out, "Frames: %llu in %.3f s (%.2f fps), %llu skipped\n",
+          (unsigned long long)Stats.Bytes.Count, Seconds,
+          Seconds > 0 ? Stats.Bytes.Count / Seconds : 0, (unsigned long long)Stats.Skipped);
+  fprintf(Out, "  %-10s %10s %12s %12s %12s %12s\n", "", "count", "mean", "p50", "p99", "max");
+  for (i = 0; i < NUM_PHASES; ++i)
+    ReportHistogram(Out, PhaseNames[i], "ms", &Stats.Phases[i], 1e-6);
+  ReportHistogram(Out, "bytes", "per frame", &Stats.Bytes, 1);
+  ReportHistogram(Out, "cells", "per frame", &Stats.Cells, 1);
+  ReportHistogram(Out, "latency", "ms from KEY press to frame", &Stats.Latency, 1e-6);
+  fflush(Out);
+}
+
+// Called once per frame: writes the periodic summary when it is due.
+void TickFrameStats() {
+  long long Now;
+  if (!Stats.Enabled || !Stats.IntervalNs)
+    return;
+  Now = NowNs();
+  if (Now - Stats.LastReport < Stats.IntervalNs)
+    return;
+  Stats.LastReport = Now;
+  ReportFrameStats(Stats.Out);
+}
+
+// Write the final summary and stop.
+void StopFrameStats() {
+  if (!Stats.Enabled)
+    return;
+  ReportFrameStats(Stats.Out);
+  if (Stats.Out != stderr)
+    fclose(Stats.Out);
+  Stats.Enabled = 0;
+}
+
+#endif
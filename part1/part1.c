@@ -23,11 +23,15 @@ int main(void) {
   for (i = 0; i < strlen(HelpMessage); ++i)
     PlotChar(i+1, 3, RED, HelpMessage[i]);
 
+  // Send the frame to the terminal.
+  PresentFrame();
+
   // Block until the user hits enter.
   getchar();
   // Reset the terminal
   ResetTerminal();
   // Flush all in buffer to stdout.
   fflush(stdout);
+  ReleaseFrame();
   return 0;
 }
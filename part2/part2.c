@@ -7,7 +7,6 @@
 char HelpMessage[] = "press [return] to exit!";
 
 int main() {
-  struct Point *TempPoint;
   int i;
 
   InitializeTerminal();
@@ -19,11 +18,9 @@ int main() {
   GenPoint(XRange - 1, YRange >> 2, 0, 0, LT_BLUE, '4');
   GenPoint(XRange, YRange-2, 0, 0, BLUE, '5');
 
-  TempPoint = AllPoints;
-  while (TempPoint) {
-    PlotLine(1, YRange, TempPoint->X, TempPoint->Y, TempPoint->Color);
-    PlotPoint(TempPoint);
-    TempPoint = TempPoint->Next;
+  ForEachPoint(i) {
+    PlotLine(1, YRange, Points.X[i], Points.Y[i], Points.Color[i]);
+    PlotPoint(i);
   }
 
   // Write Help Message
@@ -31,10 +28,12 @@ int main() {
     PlotChar(i+1, YRange, RED, HelpMessage[i]);
   }
 
+  PresentFrame();
 
   getchar();
   ResetTerminal();
   fflush(stdout);
   DeletePoints();
+  ReleaseFrame();
   return 0;
 }
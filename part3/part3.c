@@ -1,31 +1,22 @@
-#include <signal.h>
 #include <stdio.h>
 #include <time.h>
 
+#include "eventloop.h"
+#include "framescheduler.h"
 #include "plotutils.h"
 
 
-volatile sig_atomic_t Running = 1;
+int Running = 1;
 int CurrentY = 0;
 int Inc = 1;
 
-void IntHandler(int inter) { Running = 0; }
-
 void HandleTerminalResize() {
-  struct winsize w;
-  ioctl(0, TIOCGWINSZ, &w);
-
-  // Clear the screen if the window was resized.
-  // Technically, SIGWINCH may be issued by a non
-  // resize event, therefore this prevents us
-  // from resizing too frequently.
-  if (XRange != w.ws_col || YRange != w.ws_row) {
-    ClearTerminal();
-  }
+  // Update the XRange and YRange (the limits of the term.)
+  GetTerminalSize();
 
-  // Now, update the XRange and YRange (the limits of the term.)
-  XRange = w.ws_col;
-  YRange = w.ws_row;
+  // NOTE: We no longer clear the screen here: BeginFrame() notices
+  // that the size has changed, and resizes (and clears) the frame
+  // before the next one is drawn.
 
   if (CurrentY >= YRange) {
     Inc = 0;
@@ -36,40 +27,62 @@ void HandleTerminalResize() {
 int main() {
 
   int i = 0;
-
-  // Register the signal handlers.
-  signal(SIGINT, IntHandler);
-  signal(SIGWINCH, HandleTerminalResize);
+  int Steps;
+  uint32_t Events;
+
+  // Signals and frame ticks wake up the event loop (see eventloop.h);
+  // it must be started before any thread is.
+  if (!StartEventLoop(&Loop)) {
+    perror("Failed to start the event loop");
+    return 1;
+  }
 
   // Get the terminal ready for animations.
   InitializeTerminal();
 
+  // A new frame every 0.1 Seconds.
+  StartScheduler(&Scheduler, 100000000LL);
 
   while (Running) {
     // Here, we draw the line,
     // pause, and then draw black over the line.
     // We could have also just cleared the screen.
+    BeginFrame();
     PlotLine(0, CurrentY, XRange, CurrentY, Colors[i % NUM_COLORS]);
-    nanosleep((const struct timespec[]){{0, 100000000L}}, NULL);
+    PresentFrame();
+    // Show the line until the next frame is due.
+    Events = WaitForEvents(&Loop, &Scheduler, &Steps);
+    if (Events & EVENT_QUIT)
+      Running = 0;
     ClearLine(0, CurrentY, XRange, CurrentY);
-    // Inc will indicate if we are moving up or down
-    // in the animation.
-    if (Inc)
-      CurrentY += 1;
-    else
-      CurrentY -= 1;
-
-    // When the line hits the terminal boundaries, flip the direction
-    // of travel.
-    if (CurrentY >= YRange)
-      Inc = 0;
-    if (CurrentY <= 1)
-      Inc = 1;
-    i++;
+    // The terminal is resized between frames, never in a signal handler.
+    if (Events & EVENT_RESIZE)
+      HandleTerminalResize();
+    // Move the line once for every step that came due (more than once
+    // if we fell behind).
+    while (Steps-- > 0) {
+      // Inc will indicate if we are moving up or down
+      // in the animation.
+      if (Inc)
+        CurrentY += 1;
+      else
+        CurrentY -= 1;
+
+      // When the line hits the terminal boundaries, flip the direction
+      // of travel.
+      if (CurrentY >= YRange)
+        Inc = 0;
+      if (CurrentY <= 1)
+        Inc = 1;
+      i++;
+    }
   }
 
   // Reset's the terminal
   ResetTerminal();
   fflush(stdout);
+  ReportScheduler(&Scheduler, stderr);
+  ReleaseFrame();
+  StopEventLoop(&Loop);
   return 0;
 }
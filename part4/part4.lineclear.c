@@ -1,26 +1,20 @@
-#include <signal.h>
 #include <stdio.h>
 #include <time.h>
 
+#include "eventloop.h"
+#include "framescheduler.h"
 #include "plotutils.h"
+#include "trace.h"
 
-volatile sig_atomic_t Running = 1;
-struct timespec AnimationTime;
-
-void IntHandler(int inter) { Running = 0; }
+int Running = 1;
 
 void HandleTerminalResize() {
-  struct winsize w;
-  struct Point *Tmp = AllPoints;
-
-  ioctl(0, TIOCGWINSZ, &w);
-
-  if (XRange != w.ws_col || YRange != w.ws_row) {
-    ClearTerminal();
-  }
+  int i;
 
-  XRange = w.ws_col;
-  YRange = w.ws_row;
+  // The frame is resized (and the terminal cleared) by BeginFrame().
+  GetTerminalSize();
+  // (Or the size it had at this point of the replayed run.)
+  TraceTerminalSize(&Trace, &XRange, &YRange);
 
   // We loop through all of our points
   // and check if any of the points were outside
@@ -28,91 +22,86 @@ void HandleTerminalResize() {
   //
   // If so, we set the new X,Y coordinate to be within the window
   // within a 4-char space away from the edge.
-  while (Tmp) {
-    if (Tmp->X > XRange) {
-      Tmp->X = XRange;
-      Tmp->dX = -1;
+  ForEachPoint(i) {
+    if (Points.X[i] > XRange) {
+      Points.X[i] = XRange;
+      Points.dX[i] = -1;
     }
-    if (Tmp->Y > YRange) {
-      Tmp->Y = YRange;
-      Tmp->dY = -1;
+    if (Points.Y[i] > YRange) {
+      Points.Y[i] = YRange;
+      Points.dY[i] = -1;
     }
-    Tmp = Tmp->Next;
   }
 }
 
 int main() {
 
   int i = 0;
-  struct Point *T1 = NULL;
-  struct Point *T2 = NULL;
-
-  signal(SIGINT, IntHandler);
-  signal(SIGWINCH, HandleTerminalResize);
+  int Steps;
+  uint32_t Events;
+
+  // Signals and frame ticks wake up the event loop (see eventloop.h);
+  // it must be started before any thread is.
+  if (!StartEventLoop(&Loop)) {
+    perror("Failed to start the event loop");
+    return 1;
+  }
 
-  srand(time(NULL));
+  // Record this run (or replay a recorded one) if TRACE_RECORD (or
+  // TRACE_REPLAY) is set; see trace.h.
+  StartTrace(&Trace, time(NULL));
+  SeedRandom(&PointRandom, Trace.Seed);
   InitializeTerminal();
+  TraceTerminalSize(&Trace, &XRange, &YRange);
+  // Remember the cells we draw, so ClearPointLoop() can erase exactly those.
+  RecordFootprint(&Footprint, 1, FrameWidth * FrameHeight);
 
   for (i = 0; i < 3; ++i) {
     GenRandPoint();
   }
 
-  // Pause the animation every 0.05 Seconds.
-  AnimationTime.tv_sec = 0;
-  AnimationTime.tv_nsec = 50000000;
+  // A new frame (and one step of the animation) every 0.05 Seconds.
+  StartScheduler(&Scheduler, 50000000LL);
 
   while (Running) {
 
-    // First, Clear the terminal:
-    // ClearTerminal();
+    // First, make sure the frame matches the terminal.
+    // The cells drawn last frame are erased (through the footprint)
+    // when this one is presented, so we do not need to clear the frame.
+    BeginFrame();
 
     // Then, Draw the Points and Lines.
-    T1 = AllPoints;
-    while (T1) {
-      T2 = T1->Next;
-      // Get ith and (i+1)th Nodes.
-      // Draw a line between them, and use the ith color.
-      if (T1 && T2) {
-        PlotLine(T1->X, T1->Y, T2->X, T2->Y, T1->Color);
-      }
-      // If we are the end of all the points, wrap around (as long as AllPoints
-      // is valid.) Draw the line.
-      if (T1 && !T2 && AllPoints && AllPoints->Next != T1) {
-        PlotLine(T1->X, T1->Y, AllPoints->X, AllPoints->Y, T1->Color);
-        PlotPoint(AllPoints);
-      }
-      PlotPoint(T1);
-      T1 = T1->Next;
-    }
-
-    nanosleep(&AnimationTime, NULL);
-
-    T1 = AllPoints;
-    while (T1) {
-      T2 = T1->Next;
-      // Get ith and (i+1)th Nodes.
-      // Draw a line between them, and use the ith color.
-      if (T1 && T2) {
-        ClearLine(T1->X, T1->Y, T2->X, T2->Y);
-      }
-      // If we are the end of all the points, wrap around (as long as AllPoints
-      // is valid.) Draw the line.
-      if (T1 && !T2 && AllPoints && AllPoints->Next != T1) {
-        ClearLine(T1->X, T1->Y, AllPoints->X, AllPoints->Y);
-      }
-      T1 = T1->Next;
-    }
-
-    // Update the points based on their dX and dY
-    UpdatePoints();
-
-    // Show the animation for a while.
-    // nanosleep(&AnimationTime, NULL);
+    // P(i) is connected to P(i+1) with the ith color, and the
+    // last point wraps around to P(0).
+    PlotPointLoop(1);
+
+    PresentFrame();
+    // Show the animation until the next frame is due.
+    Events = TraceEvents(&Trace, &Loop, &Scheduler, &Steps);
+    if (Events & EVENT_QUIT)
+      Running = 0;
+    // The terminal is resized between frames, never in a signal handler.
+    if (Events & EVENT_RESIZE)
+      HandleTerminalResize();
+
+    // Draw over the lines we have just shown.
+    ClearPointLoop();
+
+    // Update the points based on their dX and dY (once for every
+    // step that came due).
+    while (Steps-- > 0)
+      UpdatePoints();
   }
 
   // Reset's the terminal
   ResetTerminal();
   fflush(stdout);
+  ReportScheduler(&Scheduler, stderr);
+  StopTrace(&Trace, stderr);
   DeletePoints();
+  ReleaseRasterBatch();
+  ReleaseFrame();
+  ReleaseFootprint(&Footprint);
+  StopEventLoop(&Loop);
   return 0;
 }
@@ -1,262 +1,723 @@
-#include <asm/io.h>           // for mmap
-#include <linux/fs.h>         // struct file, struct file_operations
-#include <linux/init.h>       // for __init, see code
-#include <linux/miscdevice.h> // for misc_device_register and struct miscdev
-#include <linux/module.h>     // for module init and exit macros
-#include <linux/uaccess.h>    // for copy_to_user, see code
-
-#include "../address_map_arm.h"
-
-MODULE_LICENSE("GPL");
-MODULE_AUTHOR("Nicholas Giamblanco");
-MODULE_DESCRIPTION("KEY and SW Device Drivers");
-
-#define SUCCESS 0
-
-// Defines for Registered State.
-#define NOT_REGISTERED 0
-#define REGISTERED 1
-
-// Constant Strings for KEY and SW.
-#define KEY_DEV_NAME "KEY"
-#define SW_DEV_NAME "SW"
-
-// Define the PTRs to LW-Bridge, KEY and SW.
-static void *LWVirtual;
-static volatile int *KEYPtr;
-static volatile int *SWPtr;
-
-// Declare the methods that both KEY and SW device drivers will
-// require.
-// NOTES:
-// 1. There is NO write function declared (cannot write to
-//    these drivers).
-// 2. Three functions can be shared (to reduce code clutter).
-//    which have the prefix KEYSW
-static int KEYSW_device_open(struct inode *, struct file *);
-static int KEYSW_device_release(struct inode *, struct file *);
-static loff_t KEYSW_device_seek(struct file *, loff_t, int);
-
-static ssize_t KEY_device_read(struct file *, char *, size_t, loff_t *);
-static ssize_t SW_device_read(struct file *, char *, size_t, loff_t *);
-
-// Define the File Operations for both /dev/KEY and /dev/SW
-//
-// NOTES:
-// 1. Since we can only read from KEYs and SW,
-//    there is no need to include a file-write operation.
-// 2. I've opted to use llseek to reset the position of the
-//    the file offset: an alternative is to check if 0-bytes
-//    were sent, and then correct the offset then.
-//    However, by having the user reset the file pointer's offset
-//    the user can now control when to read in NEW data from the devices.
-static struct file_operations KEYDevFops = {.owner = THIS_MODULE,
-                                            .read = KEY_device_read,
-                                            .write = NULL,
-                                            .open = KEYSW_device_open,
-                                            .release = KEYSW_device_release,
-                                            .llseek = KEYSW_device_seek};
-
-static struct file_operations SWDevFops = {.owner = THIS_MODULE,
-                                           .read = SW_device_read,
-                                           .write = NULL,
-                                           .open = KEYSW_device_open,
-                                           .release = KEYSW_device_release,
-                                           .llseek = KEYSW_device_seek};
-
-// Setup Miscellaneous Dev Struct
-// We need to set the permissions
-// for the driver file:
-//
-//  User | Group | Other
-// ------+-------+------
-// R W X | R W X | R W X
-// ------+-------+------
-// 1 1 0 | 1 1 0 | 1 1 0
-//
-// Therefore .mode is 0666
-static struct miscdevice KEYDev = {.minor = MISC_DYNAMIC_MINOR,
-                                   .name = KEY_DEV_NAME,
-                                   .fops = &KEYDevFops,
-                                   .mode = 0666};
-
-static struct miscdevice SWDev = {.minor = MISC_DYNAMIC_MINOR,
-                                  .name = SW_DEV_NAME,
-                                  .fops = &SWDevFops,
-                                  .mode = 0666};
-
-static int KEYDevRegistered = NOT_REGISTERED;
-static int SWDevRegistered = NOT_REGISTERED;
-
-// 4-Keys can provide up to 2 chars (in base 10).
-// i.e., 2^4-1 = 15
-// Therefore 2 chars for representation +
-// 1 Newline character +
-// 1 Terminating character
-// = 4 total characters for the buffer.
-#define KEYBUF_MAX_SIZE 4
-static char KEYDevMsg[KEYBUF_MAX_SIZE];
-
-// 10-Switches can provude up to 4 chars (in base 10).
-// i.e., 2^10-1 = 1023
-// Therefore 4 chars for representation +
-// 1 Newline character +
-// 1 Terminating character
-// = 6 total chars for the buffer.
-#define SWBUF_MAX_SIZE 6
-static char SWDevMsg[SWBUF_MAX_SIZE];
-
-static int __init init_drivers(void) {
-  // This is an "all-or-nothing" approach, such that we will only
-  // complete the initialization of both KEYs and SWs if both are registered.
-  // 1. Register the KEY Device Driver.
-  int KEYRegisterStatus;
-  int SWRegisterStatus;
-  // 1. Register the KEY Device Driver.
-  KEYRegisterStatus = misc_register(&KEYDev);
-  if (KEYRegisterStatus < 0) {
-    // If the status returned by misc_register is less than 0,
-    // early exist the init... (something has gone wrong).
-    printk(KERN_ERR "/dev/%s: misc_register() failed\n", KEY_DEV_NAME);
-    return KEYRegisterStatus;
-  }
-  // Log that we've registered the KEY Device driver
-  printk(KERN_INFO "/dev/%s driver registered\n", KEY_DEV_NAME);
-  KEYDevRegistered = REGISTERED;
-
-  // 2. Register the SW Device Driver.
-  SWRegisterStatus = misc_register(&SWDev);
-  if (SWRegisterStatus < 0) {
-    // Again, if misc_register returns a status of less than 0,
-    // something is awry, and we early exit.
-    // Also, we will de-register the KEYdev
-    misc_deregister(&KEYDev);
-    KEYDevRegistered = NOT_REGISTERED;
-    printk(KERN_ERR "/dev/%s: misc_register() failed\n", SW_DEV_NAME);
-    return SWRegisterStatus;
-  }
-
-  printk(KERN_INFO "/dev/%s driver registered\n", SW_DEV_NAME);
-  SWDevRegistered = REGISTERED;
-
-  // 3. Complete Initialization of both KEYs and SWs by setting
-  //    their PTRs.
-  LWVirtual = ioremap_nocache(LW_BRIDGE_BASE, LW_BRIDGE_SPAN);
-  SWPtr = LWVirtual + SW_BASE;
-  KEYPtr = LWVirtual + KEY_BASE;
-
-  // Clear the PIO edgecapture register (clear any pending interrupt)
-  *(KEYPtr + 3) = 0xF;
-
-  return KEYRegisterStatus | SWRegisterStatus;
-}
-
-static void __exit stop_drivers(void) {
-  if (KEYDevRegistered && SWDevRegistered) {
-    // First, unmap the address-space.
-    // NOTE: the address space is ONLY mapped
-    //       if both drivers are successfully registered.
-    //       so it's SAFE to only unmap in this if block.
-    iounmap(LWVirtual);
-    // Proceed with de-registering these character drivers.
-    misc_deregister(&KEYDev);
-    printk(KERN_INFO "/dev/%s driver de-registered\n", KEY_DEV_NAME);
-    misc_deregister(&SWDev);
-    printk(KERN_INFO "/dev/%s driver de-registered\n", SW_DEV_NAME);
-  }
-}
-
-/* Called when a process opens /dev/KEY or /dev/SW */
-static int KEYSW_device_open(struct inode *inode, struct file *file) {
-  return SUCCESS;
-}
-
-/* Called when a process closes /dev/KEY ot /dev/SW */
-static int KEYSW_device_release(struct inode *inode, struct file *file) {
-  return 0;
-}
-
-loff_t KEYSW_device_seek(struct file *FilP, loff_t Off, int Whence) {
-  // Check if the user has requested for SEEK_SET
-  // If not, return invalid.
-  if (Whence != 0)
-    return -EINVAL;
-
-  // Now check that the offset is 0 (go back to beginning of file)
-  // If it's not return invalid.
-  if (Off != 0)
-    return -EINVAL;
-
-  // Set the file position to be 0
-  FilP->f_pos = Off;
-  // Return the user-supplied offset.
-  return Off;
-}
-
-void pretty_print(int Value, char *OutputString, int OutSize) {
-  if (snprintf(OutputString, OutSize, "%d\n", Value) < 0) {
-    printk(KERN_ERR "Error: snprintf was unsuccessful");
-    // Terminate the string at pos 0.
-    OutputString[0] = '\0';
-  }
-}
-
-static ssize_t KEY_device_read(struct file *FilP, char *Buffer, size_t Length,
-                               loff_t *Offset) {
-  size_t BytesToSend;
-  // Grab the KEY_value
-  // If Offset is 0, we are at the beginning of the file.
-  if (!(*Offset)) {
-    // If there KEYs have been pressed, get the value.
-    // otherwise, show 0.
-    if (*(KEYPtr + 3)) {
-      pretty_print(*(KEYPtr + 3), KEYDevMsg, 4);
-      *(KEYPtr + 3) = 0xF;
-    } else {
-      pretty_print(0, KEYDevMsg, 4);
-    }
-  }
-  // 1. Determine How many bytes to Send:
-  //    (a) Find How many Outstanding bytes there are
-  BytesToSend = strlen(KEYDevMsg) - (*Offset);
-  //    (b) Send the Maximum number of bytes user space can handle.
-  BytesToSend = BytesToSend > Length ? Length : BytesToSend;
-  // 2. Send out bytes to user space.
-  if (BytesToSend > 0) {
-    if (copy_to_user(Buffer, &KEYDevMsg[*Offset], BytesToSend) != 0)
-      printk(KERN_ERR "Error [KEY]: copy_to_user unsuccessful");
-    // Update the File Ptr's Offset to reflect where to read from next read.
-    *Offset += BytesToSend;
-  }
-  return BytesToSend;
-}
-
-static ssize_t SW_device_read(struct file *FilP, char *Buffer, size_t Length,
-                              loff_t *Offset) {
-  size_t BytesToSend;
-  // If Offset is 0, we are the beginning of the file
-  // read in the SWs
-  if (!(*Offset)) {
-    pretty_print(*SWPtr, SWDevMsg, 6);
-  }
-  // 1. Determine How many bytes to Send:
-  //    (a) Find How many Outstanding bytes there are.
-  BytesToSend = strlen(SWDevMsg) - (*Offset);
-  //    (b) Send the Maximum number of bytes user space can handle.
-  BytesToSend = BytesToSend > Length ? Length : BytesToSend;
-
-  // 2. Send out bytes to user space.
-  if (BytesToSend > 0) {
-    if (copy_to_user(Buffer, &SWDevMsg[*Offset], BytesToSend) != 0)
-      printk(KERN_ERR "Error [SW]: copy_to_user unsuccessful");
-    // Update the File Ptr's Offset to reflect where to read from next read.
-    *Offset += BytesToSend;
-  }
-  // Return the number of bytes sent: zero indicates EOF.
-  return BytesToSend;
-}
-
-module_init(init_drivers);
-module_exit(stop_drivers);
-
-// End of Module.
+#include <asm/io.h>           // for mmap
+#include <linux/fs.h>         // struct file, struct file_operations
+#include <linux/init.h>       // for __init, see code
+#include <linux/interrupt.h>  // for request_irq (KEY interrupts)
+#include <linux/kfifo.h>      // for the event queues
+#include <linux/ktime.h>      // for the event timestamps
+#include <linux/list.h>       // for the list of subscribers
+#include <linux/miscdevice.h> // for misc_device_register and struct miscdev
+#include <linux/mm.h>         // for remap_pfn_range (the state page)
+#include <linux/module.h>     // for module init and exit macros
+#include <linux/mutex.h>      // for the reader lock
+#include <linux/poll.h>       // for poll_wait
+#include <linux/slab.h>       // for kzalloc (simulated registers)
+#include <linux/spinlock.h>   // for the register lock
+#include <linux/timer.h>      // for sampling the switches
+#include <linux/uaccess.h>    // for copy_to_user, see code
+#include <linux/version.h>    // for LINUX_VERSION_CODE
+#include <linux/wait.h>       // for the KEY wait queue
+
+#include "../address_map_arm.h"
+#include "keysw_ioctl.h"
+
+// ioremap has always been uncached on ARM, and ioremap_nocache is gone
+// since Linux 5.6.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+#define ioremap_nocache ioremap
+#endif
+
+// del_timer_sync was renamed in Linux 6.2 (and later removed).
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define timer_delete_sync del_timer_sync
+#endif
+
+// timer_setup came in Linux 4.15. Before it, the callback got an unsigned
+// long: pass it the timer itself, which is what timer_setup passes.
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
+#define timer_setup(Timer, Callback, Flags)                                    \
+  setup_timer((Timer), (void (*)(unsigned long))(Callback), (unsigned long)(Timer))
+#endif
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Nicholas Giamblanco");
+MODULE_DESCRIPTION("KEY and SW Device Drivers");
+
+#define SUCCESS 0
+
+// Defines for Registered State.
+#define NOT_REGISTERED 0
+#define REGISTERED 1
+
+// Constant Strings for KEY and SW.
+#define KEY_DEV_NAME "KEY"
+#define SW_DEV_NAME "SW"
+
+// Define the PTRs to LW-Bridge, KEY and SW.
+static void *LWVirtual;
+static volatile int *KEYPtr;
+static volatile int *SWPtr;
+
+// With simulate=1, the LW-Bridge is replaced by plain memory, so the
+// drivers can be loaded (and tested) on any Linux box. The simulated
+// switches and KEY presses are set with the KEYSW_SIMULATE ioctl.
+static int simulate = 0;
+module_param(simulate, int, 0444);
+MODULE_PARM_DESC(simulate, "Simulate the KEY and SW registers (no hardware needed)");
+
+// The KEY PIO raises an interrupt on every press (FPGA IRQ 1 on the
+// DE1-SoC, which Linux numbers 73).
+static int key_irq = 73;
+module_param(key_irq, int, 0444);
+MODULE_PARM_DESC(key_irq, "Interrupt of the KEY PIO");
+static int KEYIrqRegistered = NOT_REGISTERED;
+
+// Taking the KEY presses (read + clear) must not race with another reader
+// (or with the interrupt).
+static DEFINE_SPINLOCK(RegisterLock);
+
+// KEYs pressed since they were last taken: the interrupt moves the
+// edges here (so it can acknowledge them), and wakes up KEYWait.
+static int PendingKEYs = 0;
+static DECLARE_WAIT_QUEUE_HEAD(KEYWait);
+
+// The state page which /dev/KEYSW maps into user space (read-only), see
+// struct KEYSWPage. It is written under RegisterLock.
+// The switches raise no interrupt, so a timer samples them (and any KEY
+// presses the interrupt has not delivered) every sample_ms milliseconds.
+static struct KEYSWPage *StatePage;
+static struct timer_list SampleTimer;
+static int sample_ms = 10;
+module_param(sample_ms, int, 0444);
+MODULE_PARM_DESC(sample_ms, "Milliseconds between two samples of the switches");
+
+// Every open file of /dev/KEYSW has a reader. Once subscribed
+// (KEYSW_SUBSCRIBE), it is on the Subscribers list (under RegisterLock),
+// and gets its own copy of every KEY event.
+struct KEYSWReader {
+  int Blocking;          // Reads of the state wait for a KEY press
+  int Subscribed;        // Reads return events
+  u32 Dropped;           // Events lost since the last one queued
+  struct mutex ReadLock; // Takes the events out of the queue
+  struct list_head Node;
+  DECLARE_KFIFO_PTR(Events, struct KEYSWEvent);
+};
+
+static LIST_HEAD(Subscribers);
+static int event_queue = 64;
+module_param(event_queue, int, 0444);
+MODULE_PARM_DESC(event_queue, "Number of KEY events queued for each subscriber");
+
+// The KEYs which are down: a press is followed by a release once the
+// KEY reads as up again (which the timer samples).
+static int KEYsDown = 0;
+
+// Declare the methods that both KEY and SW device drivers will
+// require.
+// NOTES:
+// 1. There is NO write function declared (cannot write to
+//    these drivers).
+// 2. Three functions can be shared (to reduce code clutter).
+//    which have the prefix KEYSW
+static int KEYSW_device_open(struct inode *, struct file *);
+static int KEYSW_device_release(struct inode *, struct file *);
+static int KEYSW_reader_open(struct inode *, struct file *);
+static int KEYSW_reader_release(struct inode *, struct file *);
+static loff_t KEYSW_device_seek(struct file *, loff_t, int);
+
+static ssize_t KEY_device_read(struct file *, char *, size_t, loff_t *);
+static ssize_t SW_device_read(struct file *, char *, size_t, loff_t *);
+static ssize_t KEYSW_device_read(struct file *, char *, size_t, loff_t *);
+static long KEYSW_device_ioctl(struct file *, unsigned int, unsigned long);
+static unsigned int KEYSW_device_poll(struct file *, poll_table *);
+static int KEYSW_device_mmap(struct file *, struct vm_area_struct *);
+static irqreturn_t KEY_irq_handler(int, void *);
+static void SampleKEYSW(struct timer_list *);
+
+// Define the File Operations for both /dev/KEY and /dev/SW
+//
+// NOTES:
+// 1. Since we can only read from KEYs and SW,
+//    there is no need to include a file-write operation.
+// 2. I've opted to use llseek to reset the position of the
+//    the file offset: an alternative is to check if 0-bytes
+//    were sent, and then correct the offset then.
+//    However, by having the user reset the file pointer's offset
+//    the user can now control when to read in NEW data from the devices.
+static struct file_operations KEYDevFops = {.owner = THIS_MODULE,
+                                            .read = KEY_device_read,
+                                            .write = NULL,
+                                            .open = KEYSW_device_open,
+                                            .release = KEYSW_device_release,
+                                            .llseek = KEYSW_device_seek};
+
+static struct file_operations SWDevFops = {.owner = THIS_MODULE,
+                                           .read = SW_device_read,
+                                           .write = NULL,
+                                           .open = KEYSW_device_open,
+                                           .release = KEYSW_device_release,
+                                           .llseek = KEYSW_device_seek};
+
+// /dev/KEYSW returns both KEY and SW as a binary struct KEYSWState
+// (see keysw_ioctl.h), with a read or an ioctl. Every read is a new
+// sample, so there is no offset to rewind.
+// poll/select report it readable once a KEY has been pressed, and reads
+// can be made to wait for a press (see KEYSW_SET_BLOCKING).
+// Its first page can be mapped, to sample the state with plain loads.
+// Each open file can instead subscribe to a queue of KEY events.
+static struct file_operations KEYSWDevFops = {.owner = THIS_MODULE,
+                                              .read = KEYSW_device_read,
+                                              .write = NULL,
+                                              .open = KEYSW_reader_open,
+                                              .release = KEYSW_reader_release,
+                                              .unlocked_ioctl = KEYSW_device_ioctl,
+                                              .poll = KEYSW_device_poll,
+                                              .mmap = KEYSW_device_mmap,
+                                              .llseek = noop_llseek};
+
+// Setup Miscellaneous Dev Struct
+// We need to set the permissions
+// for the driver file:
+//
+//  User | Group | Other
+// ------+-------+------
+// R W X | R W X | R W X
+// ------+-------+------
+// 1 1 0 | 1 1 0 | 1 1 0
+//
+// Therefore .mode is 0666
+static struct miscdevice KEYDev = {.minor = MISC_DYNAMIC_MINOR,
+                                   .name = KEY_DEV_NAME,
+                                   .fops = &KEYDevFops,
+                                   .mode = 0666};
+
+static struct miscdevice SWDev = {.minor = MISC_DYNAMIC_MINOR,
+                                  .name = SW_DEV_NAME,
+                                  .fops = &SWDevFops,
+                                  .mode = 0666};
+
+static struct miscdevice KEYSWDev = {.minor = MISC_DYNAMIC_MINOR,
+                                     .name = KEYSW_DEV_NAME,
+                                     .fops = &KEYSWDevFops,
+                                     .mode = 0666};
+
+static int KEYDevRegistered = NOT_REGISTERED;
+static int SWDevRegistered = NOT_REGISTERED;
+static int KEYSWDevRegistered = NOT_REGISTERED;
+
+// 4-Keys can provide up to 2 chars (in base 10).
+// i.e., 2^4-1 = 15
+// Therefore 2 chars for representation +
+// 1 Newline character +
+// 1 Terminating character
+// = 4 total characters for the buffer.
+#define KEYBUF_MAX_SIZE 4
+static char KEYDevMsg[KEYBUF_MAX_SIZE];
+
+// 10-Switches can provude up to 4 chars (in base 10).
+// i.e., 2^10-1 = 1023
+// Therefore 4 chars for representation +
+// 1 Newline character +
+// 1 Terminating character
+// = 6 total chars for the buffer.
+#define SWBUF_MAX_SIZE 6
+static char SWDevMsg[SWBUF_MAX_SIZE];
+
+static int __init init_drivers(void) {
+  // This is an "all-or-nothing" approach, such that we will only
+  // complete the initialization of both KEYs and SWs if both are registered.
+  // 1. Register the KEY Device Driver.
+  int KEYRegisterStatus;
+  int SWRegisterStatus;
+  // 1. Register the KEY Device Driver.
+  KEYRegisterStatus = misc_register(&KEYDev);
+  if (KEYRegisterStatus < 0) {
+    // If the status returned by misc_register is less than 0,
+    // early exist the init... (something has gone wrong).
+    printk(KERN_ERR "/dev/%s: misc_register() failed\n", KEY_DEV_NAME);
+    return KEYRegisterStatus;
+  }
+  // Log that we've registered the KEY Device driver
+  printk(KERN_INFO "/dev/%s driver registered\n", KEY_DEV_NAME);
+  KEYDevRegistered = REGISTERED;
+
+  // 2. Register the SW Device Driver.
+  SWRegisterStatus = misc_register(&SWDev);
+  if (SWRegisterStatus < 0) {
+    // Again, if misc_register returns a status of less than 0,
+    // something is awry, and we early exit.
+    // Also, we will de-register the KEYdev
+    misc_deregister(&KEYDev);
+    KEYDevRegistered = NOT_REGISTERED;
+    printk(KERN_ERR "/dev/%s: misc_register() failed\n", SW_DEV_NAME);
+    return SWRegisterStatus;
+  }
+
+  printk(KERN_INFO "/dev/%s driver registered\n", SW_DEV_NAME);
+  SWDevRegistered = REGISTERED;
+
+  // 3. Complete Initialization of both KEYs and SWs by setting
+  //    their PTRs.
+  if (simulate)
+    LWVirtual = kzalloc(LW_BRIDGE_SPAN, GFP_KERNEL);
+  else
+    LWVirtual = ioremap_nocache(LW_BRIDGE_BASE, LW_BRIDGE_SPAN);
+  if (!LWVirtual) {
+    misc_deregister(&SWDev);
+    misc_deregister(&KEYDev);
+    SWDevRegistered = KEYDevRegistered = NOT_REGISTERED;
+    printk(KERN_ERR "KEY_SW: could not map the LW-Bridge\n");
+    return -ENOMEM;
+  }
+  SWPtr = LWVirtual + SW_BASE;
+  KEYPtr = LWVirtual + KEY_BASE;
+
+  // Clear the PIO edgecapture register (clear any pending interrupt)
+  if (!simulate)
+    *(KEYPtr + 3) = 0xF;
+
+  // Have the KEYs interrupt us on every press. Without the interrupt
+  // (or when simulating, where KEYSW_SIMULATE raises it in software),
+  // presses are still captured, but only noticed when read.
+  if (!simulate) {
+    if (request_irq(key_irq, KEY_irq_handler, IRQF_SHARED, "KEY_SW", &KEYSWDev) < 0) {
+      printk(KERN_WARNING "KEY_SW: could not register IRQ %d\n", key_irq);
+    } else {
+      KEYIrqRegistered = REGISTERED;
+      // Enable the interrupt of every KEY (interruptmask register).
+      *(KEYPtr + 2) = 0xF;
+    }
+  }
+
+  // 4. Register the combined (binary) KEYSW Device Driver, now that the
+  //    registers are mapped, along with its state page.
+  StatePage = (struct KEYSWPage *)get_zeroed_page(GFP_KERNEL);
+  if (!StatePage)
+    printk(KERN_ERR "/dev/%s: could not allocate the state page\n", KEYSW_DEV_NAME);
+  else if (misc_register(&KEYSWDev) < 0)
+    printk(KERN_ERR "/dev/%s: misc_register() failed\n", KEYSW_DEV_NAME);
+  else
+    KEYSWDevRegistered = REGISTERED;
+  if (KEYSWDevRegistered) {
+    printk(KERN_INFO "/dev/%s driver registered%s\n", KEYSW_DEV_NAME,
+           simulate ? " (simulated registers)" : "");
+    if (sample_ms < 1)
+      sample_ms = 1;
+    timer_setup(&SampleTimer, SampleKEYSW, 0);
+    SampleKEYSW(&SampleTimer);
+  }
+
+  return KEYRegisterStatus | SWRegisterStatus;
+}
+
+static void __exit stop_drivers(void) {
+  if (KEYDevRegistered && SWDevRegistered) {
+    if (KEYIrqRegistered) {
+      *(KEYPtr + 2) = 0;
+      free_irq(key_irq, &KEYSWDev);
+    }
+    if (KEYSWDevRegistered) {
+      timer_delete_sync(&SampleTimer);
+      misc_deregister(&KEYSWDev);
+      printk(KERN_INFO "/dev/%s driver de-registered\n", KEYSW_DEV_NAME);
+    }
+    // A mapping keeps /dev/KEYSW open (and so the module loaded), so
+    // the page is no longer mapped anywhere.
+    if (StatePage)
+      free_page((unsigned long)StatePage);
+    // First, unmap the address-space.
+    // NOTE: the address space is ONLY mapped
+    //       if both drivers are successfully registered.
+    //       so it's SAFE to only unmap in this if block.
+    if (simulate)
+      kfree(LWVirtual);
+    else
+      iounmap(LWVirtual);
+    // Proceed with de-registering these character drivers.
+    misc_deregister(&KEYDev);
+    printk(KERN_INFO "/dev/%s driver de-registered\n", KEY_DEV_NAME);
+    misc_deregister(&SWDev);
+    printk(KERN_INFO "/dev/%s driver de-registered\n", SW_DEV_NAME);
+  }
+}
+
+// Clear Edges from the edgecapture register (RegisterLock held).
+// Only those edges are cleared (the register is write-1-to-clear), so a
+// press arriving in between is not lost.
+static void AckKEYEdges(int Edges) {
+  if (!Edges)
+    return;
+  // Plain memory does not clear on write.
+  if (simulate)
+    *(KEYPtr + 3) &= ~Edges;
+  else
+    *(KEYPtr + 3) = Edges;
+}
+
+// Publish the switches, and count the KEY presses in Edges, in the
+// state page (RegisterLock held).
+static void UpdateStatePage(int Edges) {
+  int i;
+
+  if (!StatePage)
+    return;
+  // Odd while the page is being written: readers retry.
+  WRITE_ONCE(StatePage->Sequence, StatePage->Sequence + 1);
+  smp_wmb();
+  WRITE_ONCE(StatePage->Switches, *SWPtr & 0x3FF);
+  for (i = 0; i < KEYSW_NUM_KEYS; ++i) {
+    if (Edges & (1 << i))
+      WRITE_ONCE(StatePage->Presses[i], StatePage->Presses[i] + 1);
+  }
+  smp_wmb();
+  WRITE_ONCE(StatePage->Sequence, StatePage->Sequence + 1);
+}
+
+// Queue an event of Type for every KEY in Keys, for every subscriber
+// (RegisterLock held).
+static void QueueKEYEvents(int Keys, int Type) {
+  struct KEYSWReader *Reader;
+  struct KEYSWEvent Event;
+  int i;
+
+  Event.Time = ktime_get_ns();
+  Event.Type = Type;
+  Event.Switches = *SWPtr & 0x3FF;
+  for (i = 0; i < KEYSW_NUM_KEYS; ++i) {
+    if (!(Keys & (1 << i)))
+      continue;
+    Event.Key = i;
+    list_for_each_entry(Reader, &Subscribers, Node) {
+      Event.Dropped = Reader->Dropped;
+      if (kfifo_put(&Reader->Events, Event))
+        Reader->Dropped = 0;
+      else
+        Reader->Dropped++;
+    }
+  }
+}
+
+// The KEYs in Edges were pressed (and acknowledged): publish them
+// (RegisterLock held).
+static void PublishKEYEdges(int Edges) {
+  if (!Edges)
+    return;
+  UpdateStatePage(Edges);
+  QueueKEYEvents(Edges, KEYSW_PRESS);
+  KEYsDown |= Edges;
+}
+
+// Take the KEYs pressed since the last call, and clear them.
+static int TakeKEYEdges(void) {
+  unsigned long Flags;
+  int Edges, Found;
+
+  spin_lock_irqsave(&RegisterLock, Flags);
+  Found = *(KEYPtr + 3) & 0xF;
+  AckKEYEdges(Found);
+  PublishKEYEdges(Found);
+  Edges = Found | PendingKEYs;
+  PendingKEYs = 0;
+  spin_unlock_irqrestore(&RegisterLock, Flags);
+  // Subscribers may be waiting for the presses we found.
+  if (Found)
+    wake_up_interruptible(&KEYWait);
+  return Edges;
+}
+
+// Returns 1 if a KEY has been pressed since the KEYs were last taken.
+static int KEYsPending(void) {
+  return PendingKEYs || (*(KEYPtr + 3) & 0xF);
+}
+
+// A KEY was pressed: move the edges to PendingKEYs (acknowledging the
+// interrupt), and wake up anyone waiting for a press.
+// KEYSW_SIMULATE calls this directly, as a software interrupt.
+static irqreturn_t KEY_irq_handler(int Irq, void *DevId) {
+  unsigned long Flags;
+  int Edges;
+
+  spin_lock_irqsave(&RegisterLock, Flags);
+  Edges = *(KEYPtr + 3) & 0xF;
+  AckKEYEdges(Edges);
+  PendingKEYs |= Edges;
+  PublishKEYEdges(Edges);
+  spin_unlock_irqrestore(&RegisterLock, Flags);
+
+  if (!Edges)
+    return IRQ_NONE;
+  wake_up_interruptible(&KEYWait);
+  return IRQ_HANDLED;
+}
+
+// Timer: publish the switches, pick up any KEY press the interrupt has
+// not delivered (e.g., when the IRQ could not be registered), and notice
+// the KEYs which have been released (the data register reads 1 while a
+// KEY is down).
+static void SampleKEYSW(struct timer_list *Timer) {
+  unsigned long Flags;
+  int Released;
+
+  KEY_irq_handler(key_irq, &KEYSWDev);
+  spin_lock_irqsave(&RegisterLock, Flags);
+  UpdateStatePage(0);
+  Released = KEYsDown & ~(*KEYPtr & 0xF);
+  KEYsDown &= ~Released;
+  QueueKEYEvents(Released, KEYSW_RELEASE);
+  spin_unlock_irqrestore(&RegisterLock, Flags);
+  if (Released)
+    wake_up_interruptible(&KEYWait);
+  mod_timer(&SampleTimer, jiffies + msecs_to_jiffies(sample_ms));
+}
+
+static void ReadKEYSWState(struct KEYSWState *State) {
+  State->Switches = *SWPtr & 0x3FF;
+  State->Keys = TakeKEYEdges();
+}
+
+/* Called when a process opens /dev/KEY or /dev/SW */
+static int KEYSW_device_open(struct inode *inode, struct file *file) {
+  return SUCCESS;
+}
+
+/* Called when a process closes /dev/KEY ot /dev/SW */
+static int KEYSW_device_release(struct inode *inode, struct file *file) {
+  return 0;
+}
+
+/* Called when a process opens /dev/KEYSW: it gets a reader of its own */
+static int KEYSW_reader_open(struct inode *inode, struct file *file) {
+  struct KEYSWReader *Reader = kzalloc(sizeof(*Reader), GFP_KERNEL);
+  if (!Reader)
+    return -ENOMEM;
+  mutex_init(&Reader->ReadLock);
+  INIT_LIST_HEAD(&Reader->Node);
+  file->private_data = Reader;
+  return SUCCESS;
+}
+
+/* Called when a process closes /dev/KEYSW */
+static int KEYSW_reader_release(struct inode *inode, struct file *file) {
+  struct KEYSWReader *Reader = file->private_data;
+  unsigned long Flags;
+
+  if (Reader->Subscribed) {
+    spin_lock_irqsave(&RegisterLock, Flags);
+    list_del(&Reader->Node);
+    spin_unlock_irqrestore(&RegisterLock, Flags);
+    kfifo_free(&Reader->Events);
+  }
+  kfree(Reader);
+  return 0;
+}
+
+loff_t KEYSW_device_seek(struct file *FilP, loff_t Off, int Whence) {
+  // Check if the user has requested for SEEK_SET
+  // If not, return invalid.
+  if (Whence != 0)
+    return -EINVAL;
+
+  // Now check that the offset is 0 (go back to beginning of file)
+  // If it's not return invalid.
+  if (Off != 0)
+    return -EINVAL;
+
+  // Set the file position to be 0
+  FilP->f_pos = Off;
+  // Return the user-supplied offset.
+  return Off;
+}
+
+void pretty_print(int Value, char *OutputString, int OutSize) {
+  if (snprintf(OutputString, OutSize, "%d\n", Value) < 0) {
+    printk(KERN_ERR "Error: snprintf was unsuccessful");
+    // Terminate the string at pos 0.
+    OutputString[0] = '\0';
+  }
+}
+
+static ssize_t KEY_device_read(struct file *FilP, char *Buffer, size_t Length,
+                               loff_t *Offset) {
+  size_t BytesToSend;
+  // Grab the KEY_value
+  // If Offset is 0, we are at the beginning of the file.
+  if (!(*Offset)) {
+    // If there KEYs have been pressed, get the value.
+    // otherwise, show 0.
+    pretty_print(TakeKEYEdges(), KEYDevMsg, 4);
+  }
+  // 1. Determine How many bytes to Send:
+  //    (a) Find How many Outstanding bytes there are
+  BytesToSend = strlen(KEYDevMsg) - (*Offset);
+  //    (b) Send the Maximum number of bytes user space can handle.
+  BytesToSend = BytesToSend > Length ? Length : BytesToSend;
+  // 2. Send out bytes to user space.
+  if (BytesToSend > 0) {
+    if (copy_to_user(Buffer, &KEYDevMsg[*Offset], BytesToSend) != 0)
+      printk(KERN_ERR "Error [KEY]: copy_to_user unsuccessful");
+    // Update the File Ptr's Offset to reflect where to read from next read.
+    *Offset += BytesToSend;
+  }
+  return BytesToSend;
+}
+
+static ssize_t SW_device_read(struct file *FilP, char *Buffer, size_t Length,
+                              loff_t *Offset) {
+  size_t BytesToSend;
+  // If Offset is 0, we are the beginning of the file
+  // read in the SWs
+  if (!(*Offset)) {
+    pretty_print(*SWPtr, SWDevMsg, 6);
+  }
+  // 1. Determine How many bytes to Send:
+  //    (a) Find How many Outstanding bytes there are.
+  BytesToSend = strlen(SWDevMsg) - (*Offset);
+  //    (b) Send the Maximum number of bytes user space can handle.
+  BytesToSend = BytesToSend > Length ? Length : BytesToSend;
+
+  // 2. Send out bytes to user space.
+  if (BytesToSend > 0) {
+    if (copy_to_user(Buffer, &SWDevMsg[*Offset], BytesToSend) != 0)
+      printk(KERN_ERR "Error [SW]: copy_to_user unsuccessful");
+    // Update the File Ptr's Offset to reflect where to read from next read.
+    *Offset += BytesToSend;
+  }
+  // Return the number of bytes sent: zero indicates EOF.
+  return BytesToSend;
+}
+
+// Send as many whole events as fit in Buffer, waiting for one (unless
+// the file is O_NONBLOCK).
+static ssize_t ReadKEYSWEvents(struct file *FilP, char *Buffer, size_t Length) {
+  struct KEYSWReader *Reader = FilP->private_data;
+  unsigned int Copied;
+  int Status;
+
+  if (Length < sizeof(struct KEYSWEvent))
+    return -EINVAL;
+
+  if (mutex_lock_interruptible(&Reader->ReadLock))
+    return -ERESTARTSYS;
+  while (kfifo_is_empty(&Reader->Events)) {
+    mutex_unlock(&Reader->ReadLock);
+    if (FilP->f_flags & O_NONBLOCK)
+      return -EAGAIN;
+    if (wait_event_interruptible(KEYWait, !kfifo_is_empty(&Reader->Events)))
+      return -ERESTARTSYS;
+    if (mutex_lock_interruptible(&Reader->ReadLock))
+      return -ERESTARTSYS;
+  }
+  // The interrupt only adds events, so taking them needs no other lock.
+  Status = kfifo_to_user(&Reader->Events, Buffer, Length, &Copied);
+  mutex_unlock(&Reader->ReadLock);
+  return Status ? Status : Copied;
+}
+
+static ssize_t KEYSW_device_read(struct file *FilP, char *Buffer, size_t Length,
+                                 loff_t *Offset) {
+  struct KEYSWReader *Reader = FilP->private_data;
+  struct KEYSWState State;
+
+  if (Reader->Subscribed)
+    return ReadKEYSWEvents(FilP, Buffer, Length);
+
+  // Only whole states are sent.
+  if (Length < sizeof(State))
+    return -EINVAL;
+
+  // A blocking read waits for a KEY press.
+  if (Reader->Blocking && !KEYsPending()) {
+    if (FilP->f_flags & O_NONBLOCK)
+      return -EAGAIN;
+    if (wait_event_interruptible(KEYWait, KEYsPending()))
+      return -ERESTARTSYS;
+  }
+
+  ReadKEYSWState(&State);
+  if (copy_to_user(Buffer, &State, sizeof(State)) != 0)
+    return -EFAULT;
+  return sizeof(State);
+}
+
+static long KEYSW_device_ioctl(struct file *FilP, unsigned int Command,
+                               unsigned long Argument) {
+  struct KEYSWReader *Reader = FilP->private_data;
+  struct KEYSWState State;
+  unsigned long Flags;
+  int Status;
+
+  switch (Command) {
+  case KEYSW_GET_STATE:
+    ReadKEYSWState(&State);
+    if (copy_to_user((void __user *)Argument, &State, sizeof(State)) != 0)
+      return -EFAULT;
+    return SUCCESS;
+
+  case KEYSW_SIMULATE:
+    if (!simulate)
+      return -EPERM;
+    if (copy_from_user(&State, (void __user *)Argument, sizeof(State)) != 0)
+      return -EFAULT;
+    spin_lock_irqsave(&RegisterLock, Flags);
+    *SWPtr = State.Switches & 0x3FF;
+    *(KEYPtr + 3) |= State.Keys & 0xF;
+    UpdateStatePage(0);
+    spin_unlock_irqrestore(&RegisterLock, Flags);
+    // Raise the (simulated) interrupt.
+    if (State.Keys & 0xF)
+      KEY_irq_handler(key_irq, &KEYSWDev);
+    return SUCCESS;
+
+  case KEYSW_SET_BLOCKING:
+    Reader->Blocking = Argument != 0;
+    return SUCCESS;
+
+  case KEYSW_SUBSCRIBE:
+    mutex_lock(&Reader->ReadLock);
+    Status = SUCCESS;
+    if (!Reader->Subscribed) {
+      Status = kfifo_alloc(&Reader->Events, event_queue > 0 ? event_queue : 1, GFP_KERNEL);
+      if (Status == SUCCESS) {
+        spin_lock_irqsave(&RegisterLock, Flags);
+        list_add_tail(&Reader->Node, &Subscribers);
+        Reader->Subscribed = 1;
+        spin_unlock_irqrestore(&RegisterLock, Flags);
+      }
+    }
+    mutex_unlock(&Reader->ReadLock);
+    return Status;
+  }
+  return -ENOTTY;
+}
+
+static unsigned int KEYSW_device_poll(struct file *FilP, poll_table *Wait) {
+  struct KEYSWReader *Reader = FilP->private_data;
+  int Ready;
+
+  poll_wait(FilP, &KEYWait, Wait);
+  if (Reader->Subscribed)
+    Ready = !kfifo_is_empty(&Reader->Events);
+  else
+    Ready = KEYsPending();
+  return Ready ? POLLIN | POLLRDNORM : 0;
+}
+
+// Map the state page (only the first page, and only for reading).
+static int KEYSW_device_mmap(struct file *FilP, struct vm_area_struct *Vma) {
+  if (Vma->vm_pgoff != 0 || Vma->vm_end - Vma->vm_start > PAGE_SIZE)
+    return -EINVAL;
+  if (Vma->vm_flags & VM_WRITE)
+    return -EPERM;
+  // Nor can it be made writable later with mprotect.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+  vm_flags_clear(Vma, VM_MAYWRITE);
+#else
+  Vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+  return remap_pfn_range(Vma, Vma->vm_start, virt_to_phys(StatePage) >> PAGE_SHIFT,
+                         PAGE_SIZE, Vma->vm_page_prot);
+}
+
+module_init(init_drivers);
+module_exit(stop_drivers);
+
+// End of Module.
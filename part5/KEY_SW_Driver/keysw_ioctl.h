@@ -0,0 +1,84 @@
+#ifndef __KEYSW_IOCTL_H__
+#define __KEYSW_IOCTL_H__
+
+// The binary interface of /dev/KEYSW, shared by the driver (KEY_SW.c)
+// and user space (driverutils.h).
+//
+// A single read(2) of sizeof(struct KEYSWState) bytes, or a single
+// KEYSW_GET_STATE ioctl, returns the switches and the KEY presses
+// together. There is no text to parse and no file offset to rewind:
+// every read is a new sample.
+//
+// KEY presses raise an interrupt, so poll/select (or a blocking read) can
+// wait for the next press instead of sampling the KEYs every frame.
+//
+// The state can also be sampled without any system call: mmap the first
+// page of /dev/KEYSW (read-only), and read the struct KEYSWPage at its
+// start (see ReadKEYSWPage in driverutils.h).
+//
+// A reader that needs every press (and release), in order, subscribes
+// with KEYSW_SUBSCRIBE: its reads then return struct KEYSWEvent records
+// from a queue of its own, so readers do not take events from each other.
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+struct KEYSWState {
+  __u32 Switches; // One bit per switch (SW0 is bit 0)
+  __u32 Keys;     // KEYs pressed since the last read (KEY0 is bit 0)
+};
+
+#define KEYSW_NUM_KEYS 4
+
+// The state page. The driver updates it when a KEY is pressed, and
+// samples the switches every sample_ms milliseconds.
+//
+// Sequence is odd while an update is in progress (a seqlock): read it,
+// read the fields, and read it again. The fields are consistent if it
+// was even and did not change in between.
+//
+// The KEY presses are counted rather than cleared (the page is
+// read-only): a KEY was pressed if its count changed since the last sample.
+struct KEYSWPage {
+  __u32 Sequence;
+  __u32 Switches;                // One bit per switch (SW0 is bit 0)
+  __u32 Presses[KEYSW_NUM_KEYS]; // Presses of each KEY since the driver was loaded
+};
+
+#define KEYSW_PRESS 1
+#define KEYSW_RELEASE 2
+
+// An event, as returned by the reads of a subscribed file descriptor
+// (a read returns as many whole events as fit, and waits for one unless
+// the file is O_NONBLOCK).
+struct KEYSWEvent {
+  __u64 Time;     // When it happened (CLOCK_MONOTONIC, in nanoseconds)
+  __u32 Key;      // KEY number (KEY0 is 0)
+  __u32 Type;     // KEYSW_PRESS or KEYSW_RELEASE
+  __u32 Dropped;  // Events lost (the queue was full) just before this one
+  __u32 Switches; // The switches at that time
+};
+
+#define KEYSW_DEV_NAME "KEYSW"
+
+#define KEYSW_IOC_MAGIC 'k'
+
+// Read the switches, and take (and clear) the KEY presses.
+#define KEYSW_GET_STATE _IOR(KEYSW_IOC_MAGIC, 1, struct KEYSWState)
+
+// Only when the module was loaded with simulate=1: set the switches to
+// State.Switches, and press the KEYs in State.Keys (raising a simulated
+// KEY interrupt).
+#define KEYSW_SIMULATE _IOW(KEYSW_IOC_MAGIC, 2, struct KEYSWState)
+
+// Make read(2) on this file descriptor wait for a KEY press (Argument != 0),
+// or return a sample at once (Argument == 0, the default). poll/select
+// report the device readable once a KEY has been pressed either way.
+#define KEYSW_SET_BLOCKING _IO(KEYSW_IOC_MAGIC, 3)
+
+// Make read(2) on this file descriptor return queued events (see struct
+// KEYSWEvent) instead of the state. The queue holds event_queue events
+// (a module parameter); it is there from this call on.
+#define KEYSW_SUBSCRIBE _IO(KEYSW_IOC_MAGIC, 4)
+
+#endif
@@ -5,7 +5,13 @@ make;
 lsmod | grep KEY_SW
 retVal=$?
 if [ $retVal -ne 0 ]; then
-    insmod KEY_SW.ko
+    # SIMULATE=1 ./LoadModules.sh loads the drivers without the
+    # DE1-SoC hardware (see KEYSW_SIMULATE in keysw_ioctl.h).
+    if [ "$SIMULATE" = "1" ]; then
+        insmod KEY_SW.ko simulate=1
+    else
+        insmod KEY_SW.ko
+    fi
 fi
 
 cd $current;
@@ -4,21 +4,25 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+#include "KEY_SW_Driver/keysw_ioctl.h"
+#include "simkeysw.h"
+
 
 // Define number of drivers
 #define NUM_DRIVERS 2
 
-// Define Buffers for the two drivers
-// as well as their size.
-#define SW_BUF_BYTES 6
-#define KEY_BUF_BYTES 4
+// A sample is at most 4 digits and a newline (see KEY_SW.c).
+#define SAMPLE_BUF_BYTES 16
 
-char SWBuffer[SW_BUF_BYTES];
-char KEYBuffer[KEY_BUF_BYTES];
+// Times a sample is attempted before giving up on it.
+#define SAMPLE_RETRIES 3
 
 
 // Define Drivers as Integer references.
@@ -28,9 +32,11 @@ char KEYBuffer[KEY_BUF_BYTES];
 // Define a DriverRef struct to simplify our
 // development process.
 struct DriverRef {
-  char Path[15];
+  const char *Path;
   int RWP;
   int FD;
+  int Error;              // errno of the last failed sample
+  unsigned long Failures; // Samples that failed
 };
 
 struct DriverRef Drivers[NUM_DRIVERS] = {
@@ -38,6 +44,27 @@ struct DriverRef Drivers[NUM_DRIVERS] = {
     {.Path = "/dev/KEY", .RWP = O_RDONLY, .FD = -1}
 };
 
+// The switches as last read from /dev/SW (kept when a sample fails).
+uint32_t LastSwitches = 0;
+
+// The combined driver: both SW and KEY in one binary read
+// (see KEY_SW_Driver/keysw_ioctl.h). When it is available, /dev/SW and
+// /dev/KEY are not opened at all.
+#define KEYSW_PATH "/dev/" KEYSW_DEV_NAME
+const char *KEYSWPath = KEYSW_PATH;
+int KEYSWFD = -1;
+int KEYSWError;              // errno of the last failed ioctl
+unsigned long KEYSWFailures; // KEYSW_GET_STATE ioctls that failed
+
+// The state page of /dev/KEYSW, mapped read-only (NULL if it could not
+// be mapped), and the KEY press counts as of the last sample.
+const volatile struct KEYSWPage *StatePage = NULL;
+uint32_t LastPresses[KEYSW_NUM_KEYS];
+
+// A second file descriptor of /dev/KEYSW, subscribed to the KEY events
+// (see OpenKEYEvents), or -1.
+int KEYEventFD = -1;
+
 // Using a Macro to get a Driver's Open File Desc.
 #define GetFD(x) (Drivers[(x)].FD)
 #define IsRDONLY(x) (Drivers[(x)].RWP == O_RDONLY)
@@ -51,6 +78,13 @@ void ReleaseDrivers() {
   	if (GetFD(i) != -1)
   		close(GetFD(i));
   }
+  if (StatePage)
+    munmap((void *)StatePage, sizeof(struct KEYSWPage));
+  if (KEYSWFD != -1)
+    close(KEYSWFD);
+  if (KEYEventFD != -1)
+    close(KEYEventFD);
+  StopSimKEYSW(&SimKEYSW);
 }
 
 void ErrorHandler(char * Message) {
@@ -59,8 +93,46 @@ void ErrorHandler(char * Message) {
   exit(-1);
 }
 
+// Use Path instead of *Path if the environment variable Env is set.
+void OverridePath(const char **Path, const char *Env) {
+  char *Value = getenv(Env);
+  if (Value && *Value)
+    *Path = Value;
+}
+
+// Open /dev/KEYSW (and map its state page), or (with an older driver)
+// /dev/SW and /dev/KEY.
+// KEYSW_DEVICE, SW_DEVICE and KEY_DEVICE point to other files with the
+// same protocol, and KEYSW_SIM replaces the drivers altogether (see
+// simkeysw.h).
 void OpenDrivers() {
   int i;
+  void *Page;
+  char *Simulate = getenv("KEYSW_SIM");
+
+  if (Simulate && *Simulate) {
+    errno = 0;
+    if (!StartSimKEYSW(&SimKEYSW, Simulate)) {
+      // Either the timer could not be made, or Simulate is malformed.
+      errno = errno ? errno : EINVAL;
+      ErrorHandler("Cannot simulate KEYSW_SIM (<presses/s>[:<switch changes/s>[:<KEY mask>]]).");
+    }
+    return;
+  }
+  OverridePath(&KEYSWPath, "KEYSW_DEVICE");
+  OverridePath(&Drivers[SW].Path, "SW_DEVICE");
+  OverridePath(&Drivers[KEY].Path, "KEY_DEVICE");
+
+  if ((KEYSWFD = open(KEYSWPath, O_RDONLY)) != -1) {
+    Page = mmap(NULL, sizeof(struct KEYSWPage), PROT_READ, MAP_SHARED, KEYSWFD, 0);
+    if (Page != MAP_FAILED) {
+      StatePage = Page;
+      // Only the presses from now on count.
+      for (i = 0; i < KEYSW_NUM_KEYS; ++i)
+        LastPresses[i] = StatePage->Presses[i];
+    }
+    return;
+  }
   for (i = 0; i < NUM_DRIVERS; ++i) {
     if ((Drivers[i].FD = open(Drivers[i].Path, Drivers[i].RWP)) == -1) {
       ErrorHandler("Failed to open driver.");
@@ -69,26 +141,38 @@ void OpenDrivers() {
 }
 
 
+// A file descriptor which becomes readable when a KEY is pressed (for
+// poll or epoll), or -1 if there is none (the text drivers).
+int KEYReadyFD() {
+  if (SimKEYSW.Enabled)
+    return SimKEYSW.TimerFD;
+  return KEYSWFD;
+}
 
-void ReadFrom(int DevId, char *Buffer, int BufSize) {
-  int BytesRead = 0;
-  int ReadStatus;
-  while ((ReadStatus = read(GetFD(DevId), Buffer, BufSize)) != 0)
-    BytesRead += ReadStatus; // read the driver until EOF
-
-  if (ReadStatus < 0) {
-    Buffer[0] = '\0';
-    ErrorHandler("Read was unsuccessful.");
+// Subscribe to the (timestamped) KEY events of /dev/KEYSW. Returns 0 if
+// the driver does not have them.
+int OpenKEYEvents() {
+  if (KEYSWFD == -1 || (KEYEventFD = open(KEYSWPath, O_RDONLY | O_NONBLOCK)) == -1)
+    return 0;
+  if (ioctl(KEYEventFD, KEYSW_SUBSCRIBE) == -1) {
+    close(KEYEventFD);
+    KEYEventFD = -1;
+    return 0;
   }
-
-  Buffer[BytesRead] = '\0'; // NULL terminate
-
-  // Recall, We've implemented the lseek function for
-  // read-only drivers (i.e., SW and KEYs)
-  if (IsRDONLY(DevId))
-    lseek(GetFD(DevId), 0, SEEK_SET);
+  return 1;
 }
 
+// Read the KEY events queued so far into Events (at most Max of them),
+// without waiting. Returns the number of events read.
+int ReadKEYEvents(struct KEYSWEvent *Events, int Max) {
+  ssize_t BytesRead;
+  if (KEYEventFD == -1)
+    return 0;
+  BytesRead = read(KEYEventFD, Events, sizeof(struct KEYSWEvent) * Max);
+  if (BytesRead < 0)
+    return 0;
+  return BytesRead / sizeof(struct KEYSWEvent);
+}
 
 // Using strtoumax, convert a string to a uint.
 // If successful, set Safe to be 1 and return the
@@ -97,8 +181,14 @@ void ReadFrom(int DevId, char *Buffer, int BufSize) {
 // Otherwise, set Safe to be 0 (indicating the conversion was
 // not successful) and return 0.
 uint32_t StringToUint(char *DriverMsg, uint8_t *Safe) {
-  uint32_t IntegerValue = strtoumax(DriverMsg, NULL, 10);
-  if (IntegerValue == UINTMAX_MAX && errno == ERANGE) {
+  char *End;
+  uintmax_t IntegerValue;
+
+  errno = 0;
+  IntegerValue = strtoumax(DriverMsg, &End, 10);
+  // There must be a number, and nothing but the newline after it.
+  if (End == DriverMsg || (*End && *End != '\n') || errno == ERANGE ||
+      IntegerValue > UINT32_MAX) {
     *Safe = 0;
     return 0;
   }
@@ -106,5 +196,146 @@ uint32_t StringToUint(char *DriverMsg, uint8_t *Safe) {
   return IntegerValue;
 }
 
+// Sample driver DevId with a single pread at offset 0 (the drivers take
+// a new sample at offset 0, and pread leaves the file offset alone, so
+// there is nothing to rewind), and parse it into *Value.
+// An interrupted or garbled read is retried, up to SAMPLE_RETRIES times.
+// Returns 0 if the driver could not be sampled: the error is kept in
+// its Error, and counted in Failures (see ReportDriverErrors).
+int SampleDriver(int DevId, uint32_t *Value) {
+  char Buffer[SAMPLE_BUF_BYTES];
+  ssize_t BytesRead;
+  uint8_t SafelyRead;
+  int Try;
+
+  for (Try = 0; Try < SAMPLE_RETRIES; ++Try) {
+    BytesRead = pread(GetFD(DevId), Buffer, SAMPLE_BUF_BYTES - 1, 0);
+    if (BytesRead < 0) {
+      Drivers[DevId].Error = errno;
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      break;
+    }
+    Buffer[BytesRead] = '\0';
+    *Value = StringToUint(Buffer, &SafelyRead);
+    if (SafelyRead)
+      return 1;
+    Drivers[DevId].Error = EINVAL;
+  }
+  Drivers[DevId].Failures++;
+  return 0;
+}
+
+// Sample every driver of Drivers[] into Values (Values[SW], Values[KEY]).
+// Returns a mask with bit i set if Drivers[i] was sampled; the others
+// keep their value.
+int SampleAll(uint32_t *Values) {
+  int i;
+  int Sampled = 0;
+  for (i = 0; i < NUM_DRIVERS; ++i) {
+    if (SampleDriver(i, &Values[i]))
+      Sampled |= 1 << i;
+  }
+  return Sampled;
+}
+
+// Sample /dev/KEYSW into *State with a single KEYSW_GET_STATE ioctl.
+// An interrupted ioctl is retried, up to SAMPLE_RETRIES times.
+// Returns 0 if it could not be sampled (*State is then left untouched):
+// the error is kept in KEYSWError, and counted in KEYSWFailures.
+int SampleKEYSW(struct KEYSWState *State) {
+  struct KEYSWState Sample;
+  int Try;
+
+  for (Try = 0; Try < SAMPLE_RETRIES; ++Try) {
+    if (ioctl(KEYSWFD, KEYSW_GET_STATE, &Sample) != -1) {
+      *State = Sample;
+      return 1;
+    }
+    KEYSWError = errno;
+    if (errno != EINTR && errno != EAGAIN)
+      break;
+  }
+  KEYSWFailures++;
+  return 0;
+}
+
+// Print how many samples of each driver failed (if any), and why (or,
+// with KEYSW_SIM, how much input was simulated).
+void ReportDriverErrors(FILE *Out) {
+  int i;
+  if (SimKEYSW.Enabled)
+    ReportSimKEYSW(&SimKEYSW, Out);
+  if (KEYSWFailures)
+    fprintf(Out, "%s: %lu samples failed (last error: %s)\n", KEYSWPath, KEYSWFailures,
+            strerror(KEYSWError));
+  for (i = 0; i < NUM_DRIVERS; ++i) {
+    if (Drivers[i].Failures)
+      fprintf(Out, "%s: %lu samples failed (last error: %s)\n", Drivers[i].Path,
+              Drivers[i].Failures, strerror(Drivers[i].Error));
+  }
+}
+
+// Sample the state page into State: no system call at all, unless a KEY
+// was pressed (see below).
+void ReadKEYSWPage(struct KEYSWState *State) {
+  struct KEYSWState Unused;
+  uint32_t Sequence, Presses[KEYSW_NUM_KEYS];
+  int i;
+
+  // Retry while the driver is (or was) updating the page.
+  do {
+    while ((Sequence = __atomic_load_n(&StatePage->Sequence, __ATOMIC_ACQUIRE)) & 1)
+      ;
+    State->Switches = StatePage->Switches;
+    for (i = 0; i < KEYSW_NUM_KEYS; ++i)
+      Presses[i] = StatePage->Presses[i];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&StatePage->Sequence, __ATOMIC_RELAXED) != Sequence);
+
+  State->Keys = 0;
+  for (i = 0; i < KEYSW_NUM_KEYS; ++i) {
+    if (Presses[i] != LastPresses[i])
+      State->Keys |= 1 << i;
+    LastPresses[i] = Presses[i];
+  }
+
+  // The presses are also kept for read/ioctl (which is what poll/select
+  // wait for): take them, or the device would stay readable.
+  if (State->Keys)
+    ioctl(KEYSWFD, KEYSW_GET_STATE, &Unused);
+}
+
+// Read the SWs and the KEYs pressed since the last call into State.
+// With /dev/KEYSW this is a few loads from its state page (or a single
+// ioctl); otherwise both text drivers are sampled (a pread each), and
+// whichever could be read is used: if /dev/SW fails, the switches keep
+// their last value, and if /dev/KEY fails, no KEY counts as pressed.
+// Returns 0 if nothing could be read (State is then left untouched).
+int ReadKEYSW(struct KEYSWState *State) {
+  uint32_t Values[NUM_DRIVERS];
+  int Sampled;
+
+  if (SimKEYSW.Enabled) {
+    ReadSimKEYSW(&SimKEYSW, State);
+    return 1;
+  }
+  if (StatePage) {
+    ReadKEYSWPage(State);
+    return 1;
+  }
+  if (KEYSWFD != -1)
+    return SampleKEYSW(State);
+
+  Sampled = SampleAll(Values);
+  if (!Sampled)
+    return 0;
+  if (Sampled & (1 << SW))
+    LastSwitches = Values[SW];
+  State->Switches = LastSwitches;
+  State->Keys = Sampled & (1 << KEY) ? Values[KEY] : 0;
+  return 1;
+}
+
 
 #endif
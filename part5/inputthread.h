@@ -0,0 +1,190 @@
+#ifndef __INPUT_THREAD_H__
+#define __INPUT_THREAD_H__
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "driverutils.h"
+#include "framescheduler.h"
+
+// With INPUT_THREAD=1, the SWs and KEYs are read by a thread of their
+// own instead of by the render loop, so a slow terminal write does not
+// delay the input (and reading the input does not delay the frame).
+//
+// The input thread owns the driver file descriptors. It waits for a KEY
+// press (or the next sample of the switches, every INPUT_SAMPLE_MS), and
+// pushes every change into a bounded single-producer/single-consumer
+// ring, without any lock. The render loop drains the ring at the start of
+// each frame (NextInput), so every press is handled, in order.
+//
+// A KEY press also writes to an eventfd, which wakes up the event loop
+// (see eventloop.h), so the press does not wait for the next frame.
+//
+// INPUT_CPU and RENDER_CPU pin the two threads to a core each (see
+// PinThread).
+
+#define INPUT_RING_SIZE 256 // A power of two
+#define INPUT_SAMPLE_MS 10
+
+struct InputEvent {
+  long long Time; // When it was read (NowNs)
+  struct KEYSWState State;
+};
+
+// Head is only written by the input thread, and Tail by the render
+// thread; each is on a cache line of its own. Both only ever grow (and
+// wrap around at 2^32): the ring holds Head - Tail events.
+struct InputRing {
+  _Alignas(64) uint32_t Head;
+  _Alignas(64) uint32_t Tail;
+  _Alignas(64) struct InputEvent Events[INPUT_RING_SIZE];
+};
+
+struct InputThread {
+  int Enabled;
+  int Stop;                // Set to stop the thread
+  int WakeFD;              // eventfd, written on every KEY press
+  int Draining;            // WakeFD was reset, and the ring is being drained
+  unsigned long Dropped;   // Changes lost because the ring was full
+  pthread_t Thread;
+  struct InputRing Ring;
+};
+
+struct InputThread InputThread = {.WakeFD = -1};
+
+// Input thread: add E to the ring. Returns 0 if the ring is full.
+int PushInput(struct InputRing *R, struct InputEvent *E) {
+  uint32_t Head = R->Head;
+  if (Head - __atomic_load_n(&R->Tail, __ATOMIC_ACQUIRE) == INPUT_RING_SIZE)
+    return 0;
+  R->Events[Head & (INPUT_RING_SIZE - 1)] = *E;
+  // Publish the event along with the new Head.
+  __atomic_store_n(&R->Head, Head + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// Render thread: take the oldest event of the ring into E. Returns 0 if
+// the ring is empty.
+int PopInput(struct InputRing *R, struct InputEvent *E) {
+  uint32_t Tail = R->Tail;
+  if (Tail == __atomic_load_n(&R->Head, __ATOMIC_ACQUIRE))
+    return 0;
+  *E = R->Events[Tail & (INPUT_RING_SIZE - 1)];
+  // Hand the slot back only once it has been copied.
+  __atomic_store_n(&R->Tail, Tail + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// Pin Thread to the core given by the environment variable Env (if it
+// is set). Returns 0 if it could not be pinned.
+int PinThread(pthread_t Thread, const char *Env) {
+  char *Value = getenv(Env);
+  cpu_set_t Cores;
+
+  if (!Value || !*Value)
+    return 1;
+  CPU_ZERO(&Cores);
+  CPU_SET(atoi(Value), &Cores);
+  if (pthread_setaffinity_np(Thread, sizeof(Cores), &Cores)) {
+    fprintf(stderr, "Could not pin the thread to core %s (%s)\n", Value, Env);
+    return 0;
+  }
+  return 1;
+}
+
+void *SampleInput(void *Arg) {
+  struct InputThread *T = (struct InputThread *)Arg;
+  // Without /dev/KEYSW (or KEYSW_SIM), poll only waits for the timeout.
+  struct pollfd KEYs = {.fd = KEYReadyFD(), .events = POLLIN};
+  struct InputEvent Event;
+  struct KEYSWState Last = {0};
+  uint64_t One = 1;
+  int First = 1;
+
+  while (!__atomic_load_n(&T->Stop, __ATOMIC_ACQUIRE)) {
+    poll(&KEYs, 1, INPUT_SAMPLE_MS);
+    if (!ReadKEYSW(&Event.State))
+      continue;
+    // Only changes are sent.
+    if (!First && !Event.State.Keys && Event.State.Switches == Last.Switches)
+      continue;
+    First = 0;
+    Last = Event.State;
+    Event.Time = NowNs();
+    if (!PushInput(&T->Ring, &Event)) {
+      T->Dropped++;
+      continue;
+    }
+    // Wake up the event loop. (If that fails, the next frame still
+    // takes the press.)
+    if (Event.State.Keys && write(T->WakeFD, &One, sizeof(One)) < 0)
+      continue;
+  }
+  return NULL;
+}
+
+// Start the input thread if INPUT_THREAD is set (and not 0). Returns 1
+// if it runs; the drivers must be open.
+int StartInputThread(struct InputThread *T) {
+  char *Env = getenv("INPUT_THREAD");
+
+  if (!Env || !atoi(Env))
+    return 0;
+  T->WakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (T->WakeFD == -1)
+    return 0;
+  if (pthread_create(&T->Thread, NULL, SampleInput, T)) {
+    close(T->WakeFD);
+    T->WakeFD = -1;
+    return 0;
+  }
+  PinThread(T->Thread, "INPUT_CPU");
+  T->Enabled = 1;
+  return 1;
+}
+
+// Render thread: take the next input read by the input thread into
+// State. Returns 0 once there is none left (call it until then).
+//
+// The eventfd is reset before the ring is drained, whether or not a KEY
+// woke us up. A press is pushed before its write, so a write which lands
+// after the reset belongs to a press which is either taken now (and the
+// next drain resets the eventfd again, for nothing) or left for the next
+// drain; either way, the eventfd never stays readable with the ring empty.
+int NextInput(struct InputThread *T, struct KEYSWState *State) {
+  struct InputEvent Event;
+  uint64_t Count;
+
+  if (!T->Draining) {
+    T->Draining = 1;
+    // EAGAIN just means there was nothing to reset.
+    if (read(T->WakeFD, &Count, sizeof(Count)) < 0)
+      Count = 0;
+  }
+  if (!PopInput(&T->Ring, &Event)) {
+    T->Draining = 0;
+    return 0;
+  }
+  *State = Event.State;
+  return 1;
+}
+
+void StopInputThread(struct InputThread *T) {
+  if (!T->Enabled)
+    return;
+  __atomic_store_n(&T->Stop, 1, __ATOMIC_RELEASE);
+  pthread_join(T->Thread, NULL);
+  close(T->WakeFD);
+  if (T->Dropped)
+    fprintf(stderr, "Input thread: %lu changes dropped (the ring was full)\n", T->Dropped);
+  T->Enabled = 0;
+  T->WakeFD = -1;
+}
+
+#endif
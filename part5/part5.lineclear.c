@@ -1,30 +1,29 @@
-#include <signal.h>
+// For pthread_setaffinity_np (see inputthread.h).
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <time.h>
 
 #include "driverutils.h"
+#include "eventloop.h"
+#include "framescheduler.h"
+#include "inputthread.h"
 #include "plotutils.h"
+#include "trace.h"
 
 // 0.02 Second [Dec/Inc]rements
 #define ANIMETIME 20000000
 
-volatile sig_atomic_t Running = 1;
+int Running = 1;
 struct timespec AnimationTime;
-
-void IntHandler(int inter) { Running = 0; }
+int ShowLines = 1;
 
 void HandleTerminalResize() {
-  struct winsize w;
-  struct Point *Tmp = AllPoints;
-
-  ioctl(0, TIOCGWINSZ, &w);
+  int i;
 
-  if (XRange != w.ws_col || YRange != w.ws_row) {
-    ClearTerminal();
-  }
-
-  XRange = w.ws_col;
-  YRange = w.ws_row;
+  // The frame is resized (and the terminal cleared) by BeginFrame().
+  GetTerminalSize();
+  // (Or the size it had at this point of the replayed run.)
+  TraceTerminalSize(&Trace, &XRange, &YRange);
 
   // We loop through all of our points
   // and check if any of the points were outside
@@ -32,147 +31,193 @@ void HandleTerminalResize() {
   //
   // If so, we set the new X,Y coordinate to be within the window
   // within a 4-char space away from the edge.
-  while (Tmp) {
-    if (Tmp->X > XRange) {
-      Tmp->X = XRange;
-      Tmp->dX = -1;
+  ForEachPoint(i) {
+    if (Points.X[i] > XRange) {
+      Points.X[i] = XRange;
+      Points.dX[i] = -1;
     }
-    if (Tmp->Y > YRange) {
-      Tmp->Y = YRange;
-      Tmp->dY = -1;
+    if (Points.Y[i] > YRange) {
+      Points.Y[i] = YRange;
+      Points.dY[i] = -1;
     }
-    Tmp = Tmp->Next;
   }
 }
 
-int main() {
-
-  int i = 0;
-  int SWValue;
+// Act on the SWs and the KEYs pressed in Input.
+void HandleInput(struct KEYSWState *Input) {
   int KEYValue;
-  uint8_t SafelyRead;
 
-  int ShowLines = 1;
+  // Keep it, for a replay of this run.
+  RecordInput(&Trace, Input->Switches, Input->Keys);
+
+  if (Input->Switches > 0)
+    ShowLines = 0;
+  else
+    ShowLines = 1;
+
+  // If there has been no activity with the KEYs, there is nothing
+  // else to do.
+  KEYValue = Input->Keys;
+  if (!KEYValue)
+    return;
+
+  // Increase Animation Speed
+  if (KEYValue & 0x1) {
+    // Cap at 0.03 Seconds.
+    if (AnimationTime.tv_nsec > 30000000)
+      AnimationTime.tv_nsec -= ANIMETIME;
+  }
 
-  struct Point *T1 = NULL;
-  struct Point *T2 = NULL;
+  // Decrease Animation Speed
+  if ((KEYValue >> 1) & 0x1) {
+    // Cap at 0.3 Seconds.
+    if (AnimationTime.tv_nsec < 300000000)
+      AnimationTime.tv_nsec += ANIMETIME;
+  }
 
-  signal(SIGINT, IntHandler);
-  signal(SIGWINCH, HandleTerminalResize);
+  // The next frame is due one (new) period after the last one,
+  // so changing the speed does not shift the animation.
+  if (KEYValue & 0x3) {
+    SetSchedulerPeriod(&Scheduler, AnimationTime.tv_nsec);
+    SetSimulationStep(&Scheduler, AnimationTime.tv_nsec);
+  }
+
+  if ((KEYValue >> 2) & 0x1) {
+    GenRandPoint();
+  }
 
-  // First, we open all drivers.
-  OpenDrivers();
+  if ((KEYValue >> 3) & 0x1) {
+    DeleteLastPoint();
+  }
+}
 
+int main() {
 
-  srand(time(NULL));
+  int i = 0;
+  struct KEYSWState Input;
+  struct KEYSWEvent KEYEvents[16];
+  int NumKEYEvents;
+
+  int Steps;
+  uint32_t Events;
+
+  // Signals, frame ticks and KEY presses all wake up the event loop
+  // (see eventloop.h); it must be started before any thread is.
+  if (!StartEventLoop(&Loop))
+    ErrorHandler("Failed to start the event loop.");
+
+  // Record this run (or replay a recorded one) if TRACE_RECORD (or
+  // TRACE_REPLAY) is set; see trace.h.
+  StartTrace(&Trace, time(NULL));
+
+  // First, we open all drivers (unless the input is replayed). With
+  // INPUT_THREAD=1 they belong to the input thread, which wakes us up on
+  // KEY presses.
+  if (Trace.Mode != TRACE_REPLAY) {
+    OpenDrivers();
+    if (StartInputThread(&InputThread))
+      AddEventSource(&Loop, InputThread.WakeFD, EVENT_INPUT);
+    else
+      AddEventSource(&Loop, KEYReadyFD(), EVENT_INPUT);
+  }
+
+
+  SeedRandom(&PointRandom, Trace.Seed);
   InitializeTerminal();
+  TraceTerminalSize(&Trace, &XRange, &YRange);
+  // Remember the cells we draw, so ClearPointLoop() can erase exactly those.
+  RecordFootprint(&Footprint, 1, FrameWidth * FrameHeight);
 
   for (i = 0; i < 3; ++i) {
     GenRandPoint();
   }
 
-  // Pause the animation every 0.2 Seconds.
+  // A new frame (and one step of the animation) every 0.2 Seconds.
   AnimationTime.tv_sec = 0;
   AnimationTime.tv_nsec = 200000000;
+  StartScheduler(&Scheduler, AnimationTime.tv_nsec);
+  // Time the phases of every frame (if FRAME_STATS is set).
+  StartFrameStats();
+  // ... including the time from every KEY press to its frame.
+  if (Stats.Enabled)
+    OpenKEYEvents();
+
+  // Start the raster threads before pinning this one (if RENDER_CPU is
+  // set), or they would all inherit the same core.
+  SetRasterThreads(0);
+  PinThread(pthread_self(), "RENDER_CPU");
 
   while (Running) {
-
-  	// Read from the SWs.
-    ReadFrom(SW, SWBuffer, SW_BUF_BYTES);
-    // Attempt to convert the contents of what we read from /dev/SW
-    //    into an integer.
-    SWValue = StringToUint(SWBuffer, &SafelyRead);
-    if (!SafelyRead)
-      goto READ_KEYS;
-
-    if (SWValue > 0)
-      ShowLines = 0;
-    else
-      ShowLines = 1;
-
-  READ_KEYS:
-    // Read from the Keys
-    ReadFrom(KEY, KEYBuffer, KEY_BUF_BYTES);
-    // Attempt to convert the contents of what we read from /dev/KEY
-    //    into an integer.
-    KEYValue = StringToUint(KEYBuffer, &SafelyRead);
-    // If there has been no activity with the KEYs, go back to the
-    // beginning of the loop.
-    if (!(SafelyRead && KEYValue))
-      goto DRAW;
-
-    // Increase Animation Speed
-    if (KEYValue & 0x1) {
-      // Cap at 0.03 Seconds.
-      if (AnimationTime.tv_nsec > 30000000)
-        AnimationTime.tv_nsec -= ANIMETIME;
-    }
-
-    // Decrease Animation Speed
-    if ((KEYValue >> 1) & 0x1) {
-      // Cap at 0.3 Seconds.
-      if (AnimationTime.tv_nsec < 300000000)
-        AnimationTime.tv_nsec += ANIMETIME;
-    }
-
-    if ((KEYValue >> 2) & 0x1) {
-      GenRandPoint();
-    }
-
-    if ((KEYValue >> 3) & 0x1) {
-      DeleteLastPoint();
+    BeginPhase(PHASE_INPUT);
+
+    // The KEY presses (with their times) which this frame will show.
+    NumKEYEvents = ReadKEYEvents(KEYEvents, 16);
+
+    // With the input thread, handle everything it has read since the
+    // last frame, in order. Otherwise, read the SWs and the KEYs (from
+    // the state page of /dev/KEYSW).
+    if (Trace.Mode == TRACE_REPLAY) {
+      while (ReplayInput(&Trace, &Input.Switches, &Input.Keys))
+        HandleInput(&Input);
+    } else if (InputThread.Enabled) {
+      while (NextInput(&InputThread, &Input))
+        HandleInput(&Input);
+    } else if (ReadKEYSW(&Input)) {
+      HandleInput(&Input);
     }
-
-  DRAW:
-    // First, Draw the Points and Lines.
-    T1 = AllPoints;
-    while (T1) {
-      if (ShowLines) {
-        T2 = T1->Next;
-        // Get ith and (i+1)th Nodes.
-        // Draw a line between them, and use the ith color.
-        if (T1 && T2) {
-          PlotLine(T1->X, T1->Y, T2->X, T2->Y, T1->Color);
-        }
-        // If we are the end of all the points, wrap around (as long as
-        // AllPoints is valid.) Draw the line.
-        if (T1 && !T2 && AllPoints && AllPoints->Next != T1) {
-          PlotLine(T1->X, T1->Y, AllPoints->X, AllPoints->Y, T1->Color);
-          PlotPoint(AllPoints);
-        }
-      }
-      PlotPoint(T1);
-      T1 = T1->Next;
+    EndPhase(PHASE_INPUT);
+
+    // First, make sure the frame matches the terminal.
+    BeginPhase(PHASE_RASTERIZE);
+    BeginFrame();
+    // Then, Draw the Points and Lines.
+    // P(i) is connected to P(i+1) with the ith color, and the
+    // last point wraps around to P(0).
+    PlotPointLoop(ShowLines);
+    EndPhase(PHASE_RASTERIZE);
+    // Send whatever changed to the terminal, and
+    // show the animation until the next frame is due.
+    PresentFrame();
+    for (i = 0; i < NumKEYEvents; ++i) {
+      if (KEYEvents[i].Type == KEYSW_PRESS)
+        CountInput(KEYEvents[i].Time);
     }
-    // Show the animation for a while.
-    nanosleep(&AnimationTime, NULL);
-
-    T1 = AllPoints;
-    while (T1) {
-      T2 = T1->Next;
-      // Get ith and (i+1)th Nodes.
-      // Draw a line between them, and use the ith color.
-      if (T1 && T2) {
-        ClearLine(T1->X, T1->Y, T2->X, T2->Y);
-      }
-      // If we are the end of all the points, wrap around (as long as
-      // AllPoints is valid.) Draw the line.
-      if (T1 && !T2 && AllPoints && AllPoints->Next != T1) {
-        ClearLine(T1->X, T1->Y, AllPoints->X, AllPoints->Y);
-      }
-      T1 = T1->Next;
-    }    
-
-    // Update the points based on their dX and dY
-    UpdatePoints();
-
-
+    BeginPhase(PHASE_SLEEP);
+    // A KEY press cuts the wait short (with 0 steps), so it is handled
+    // right away instead of at the next frame.
+    Events = TraceEvents(&Trace, &Loop, &Scheduler, &Steps);
+    if (Events & EVENT_QUIT)
+      Running = 0;
+    // The terminal is resized between frames, never in a signal handler.
+    if (Events & EVENT_RESIZE)
+      HandleTerminalResize();
+    EndPhase(PHASE_SLEEP);
+
+    // Draw over the lines we have just shown.
+    ClearPointLoop();
+
+    // Update the points based on their dX and dY (once for every
+    // step that came due).
+    BeginPhase(PHASE_SIMULATE);
+    while (Steps-- > 0)
+      UpdatePoints();
+    EndPhase(PHASE_SIMULATE);
+    TickFrameStats();
   }
 
+  StopInputThread(&InputThread);
   ReleaseDrivers();
   // Reset's the terminal
   ResetTerminal();
   fflush(stdout);
+  ReportScheduler(&Scheduler, stderr);
+  StopTrace(&Trace, stderr);
+  ReportDriverErrors(stderr);
+  StopFrameStats();
   DeletePoints();
+  ReleaseRasterBatch();
+  ReleaseFrame();
+  ReleaseFootprint(&Footprint);
+  StopEventLoop(&Loop);
   return 0;
 }
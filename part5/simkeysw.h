@@ -0,0 +1,123 @@
+#ifndef __SIM_KEYSW_H__
+#define __SIM_KEYSW_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "KEY_SW_Driver/keysw_ioctl.h"
+#include "framescheduler.h"
+
+// A stand-in for the KEYs and SWs, so part 5 runs (and its input path
+// can be profiled and stress-tested) on any Linux machine, without the
+// DE1-SoC or the kernel module.
+//
+// With KEYSW_SIM=<presses/s>[:<switch changes/s>[:<KEY mask>]], the KEYs
+// are "pressed" by a periodic timerfd: it becomes readable on every
+// press, like /dev/KEYSW does on a KEY interrupt, so the event loop (or
+// the input thread) is woken up at that rate. Each press is a random KEY
+// of the mask (all four by default). The switches toggle at random, at
+// their own rate.
+//
+// E.g., KEYSW_SIM=1000:50 presses a KEY every millisecond, and flips a
+// switch 50 times a second.
+
+#define SIM_NUM_SWITCHES 10 // SW0 to SW9
+
+struct SimKEYSW {
+  int Enabled;
+  int TimerFD;                // Readable once a press is due (-1 without presses)
+  double SwitchRate;          // Switch changes per second
+  uint32_t KEYMask;           // KEYs which may be pressed
+  uint32_t Switches;          // Current switches
+  uint32_t Random;            // xorshift32 state
+  long long LastSample;       // When the switches were last updated (NowNs)
+  double SwitchesDue;         // Switch changes due, but not made yet
+  unsigned long long Presses; // Presses generated
+  unsigned long long Flips;   // Switch changes generated
+};
+
+struct SimKEYSW SimKEYSW = {.TimerFD = -1};
+
+uint32_t SimRandom(struct SimKEYSW *Sim) {
+  uint32_t X = Sim->Random;
+  X ^= X << 13;
+  X ^= X >> 17;
+  X ^= X << 5;
+  return Sim->Random = X;
+}
+
+// Start simulating the KEYs and SWs as described by Spec (the value of
+// KEYSW_SIM). Returns 0 if Spec is malformed, or the timer cannot be made.
+int StartSimKEYSW(struct SimKEYSW *Sim, const char *Spec) {
+  double KEYRate = 0;
+  int KEYMask = (1 << KEYSW_NUM_KEYS) - 1;
+  struct itimerspec Period = {{0, 0}, {0, 0}};
+  long long PeriodNs;
+
+  Sim->SwitchRate = 0;
+  if (sscanf(Spec, "%lf:%lf:%i", &KEYRate, &Sim->SwitchRate, &KEYMask) < 1 || KEYRate < 0 ||
+      Sim->SwitchRate < 0)
+    return 0;
+  Sim->KEYMask = KEYMask & ((1 << KEYSW_NUM_KEYS) - 1);
+  Sim->Random = (uint32_t)NowNs() | 1;
+  Sim->LastSample = NowNs();
+
+  if (KEYRate > 0 && Sim->KEYMask) {
+    Sim->TimerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (Sim->TimerFD == -1)
+      return 0;
+    PeriodNs = NS_PER_SEC / KEYRate;
+    if (PeriodNs < 1)
+      PeriodNs = 1;
+    Period.it_interval.tv_sec = PeriodNs / NS_PER_SEC;
+    Period.it_interval.tv_nsec = PeriodNs % NS_PER_SEC;
+    Period.it_value = Period.it_interval;
+    timerfd_settime(Sim->TimerFD, 0, &Period, NULL);
+  }
+  Sim->Enabled = 1;
+  return 1;
+}
+
+// Read the (simulated) SWs and the KEYs pressed since the last call into
+// State, like a read of /dev/KEYSW.
+void ReadSimKEYSW(struct SimKEYSW *Sim, struct KEYSWState *State) {
+  uint64_t Due = 0;
+  long long Now = NowNs();
+  uint32_t Key;
+
+  State->Keys = 0;
+  if (Sim->TimerFD != -1 && read(Sim->TimerFD, &Due, sizeof(Due)) == sizeof(Due)) {
+    Sim->Presses += Due;
+    // Four distinct KEYs are as many as the mask can show.
+    for (; Due > 0 && State->Keys != Sim->KEYMask; --Due) {
+      do
+        Key = SimRandom(Sim) % KEYSW_NUM_KEYS;
+      while (!(Sim->KEYMask & (1 << Key)));
+      State->Keys |= 1 << Key;
+    }
+  }
+
+  Sim->SwitchesDue += (double)(Now - Sim->LastSample) / NS_PER_SEC * Sim->SwitchRate;
+  Sim->LastSample = Now;
+  for (; Sim->SwitchesDue >= 1; Sim->SwitchesDue -= 1) {
+    Sim->Switches ^= 1 << (SimRandom(Sim) % SIM_NUM_SWITCHES);
+    Sim->Flips++;
+  }
+  State->Switches = Sim->Switches;
+}
+
+void StopSimKEYSW(struct SimKEYSW *Sim) {
+  if (Sim->TimerFD != -1)
+    close(Sim->TimerFD);
+  Sim->TimerFD = -1;
+}
+
+void ReportSimKEYSW(struct SimKEYSW *Sim, FILE *Out) {
+  fprintf(Out, "Simulated input: %llu KEY presses, %llu switch changes\n", Sim->Presses,
+          Sim->Flips);
+}
+
+#endif
@@ -1,11 +1,22 @@
 #ifndef __PLOTUTILS_H__
 #define __PLOTUTILS_H__
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include "asyncoutput.h"
+#include "collision.h"
+#include "footprint.h"
+#include "frameencoder.h"
+#include "framestats.h"
+#include "pointkernels.h"
+#include "pointrandom.h"
+#include "polygonfill.h"
+
 // VT100 Color Codes
 #define BLACK 30
 #define RED 31
@@ -31,17 +42,72 @@ const int Colors[NUM_COLORS] = {
     RED,    GREEN,    YELLOW,    BLUE,    MAGENTA,    CYAN,    LT_GRAY, DK_GRAY,
     LT_RED, LT_GREEN, LT_YELLOW, LT_BLUE, LT_MAGENTA, LT_CYAN, WHITE};
 
-// This struct will represent a point to plot.
-struct Point {
-  int X;     // X Coord
-  int Y;     // Y Coord
-  int dX;    // Change in X direction
-  int dY;    // Change in Y direction
-  char Sym;  // Symbol use for ASCII disp
-  int Color; // Color for ASCII disp
-  struct Point *Next;
+// The points to plot are kept as a structure of arrays: each field of
+// every point lives in its own contiguous array, so UpdatePoints() walks
+// memory linearly instead of chasing Next pointers.
+// Point i is made of X[i], Y[i], dX[i], dY[i], Color[i] and Sym[i].
+//
+// NOTE: X, Y, dX and dY share the same (16-bit) type. Terminals are
+// nowhere near 32767 cells wide, and keeping them the same width lets
+// them be processed together.
+//
+// The arrays double in size when they fill up, and never shrink: once a
+// scene has reached its size, creating and removing points never calls
+// malloc or free.
+//
+// Since removing a point moves another one into its place, the index of a
+// point can change. A PointHandle (see below) always finds the point it
+// was created for. Handles are slots, and the slot table is a pool with a
+// free list threaded through SlotIndex.
+struct PointStore {
+  int16_t *X;     // X Coords
+  int16_t *Y;     // Y Coords
+  int16_t *dX;    // Change in X direction
+  int16_t *dY;    // Change in Y direction
+  uint8_t *Color; // Colors for ASCII disp
+  char *Sym;      // Symbols used for ASCII disp
+  uint32_t *Slot; // Handle slot of each point
+  int Count;      // Number of points
+  int Capacity;   // Number of points the arrays can hold
+
+  uint32_t *SlotIndex;      // Live slot: index of its point.
+                            // Free slot: the next free slot.
+  uint32_t *SlotGeneration; // Bumped every time a slot is freed.
+  uint32_t NumSlots;        // Number of slots handed out (live or free)
+  uint32_t FreeSlot;        // First free slot (or NO_SLOT)
+};
+
+// A PointHandle names a point for as long as it exists. Once the point
+// has been removed, its handle no longer matches the slot's generation,
+// so stale handles are detected rather than finding some other point.
+struct PointHandle {
+  uint32_t Slot;
+  uint32_t Generation; // 0 is never a live generation.
+};
+
+#define INITIAL_POINT_CAPACITY 16
+#define NO_SLOT UINT32_MAX
+#define NO_POINT ((struct PointHandle){.Slot = NO_SLOT, .Generation = 0})
+#define EMPTY_POINT_STORE ((struct PointStore){.FreeSlot = NO_SLOT})
+
+// Iterate over the index of every point (in the order they were created,
+// unless points other than the last have been removed).
+#define ForEachPoint(i) for ((i) = 0; (i) < Points.Count; ++(i))
+
+// This struct will represent a single character cell of the terminal.
+struct Cell {
+  char Sym;   // Symbol displayed in the cell
+  char Color; // Color of the symbol
 };
 
+// Blank cells are drawn as a black space (the same as ClearLine).
+#define BLANK_SYM ' '
+#define BLANK_COLOR BLACK
+
+// A front buffer cell which does not match any cell we draw: the
+// terminal shows something unknown there (see InvalidateFrontBuffer).
+#define UNKNOWN_SYM '\0'
+
 // Create two static global variables (i.e., storage local
 // to this scope) which will represent the maximum X and Y range
 // of the terminal (the terminal size)
@@ -54,57 +120,83 @@ static int ColorSelector = 0;
 // CharacterSelector will be used to cycle through the alphabet ('A' - 'Z')
 static int CharacterSelector = 0;
 
-// AllPoints is a linked-list of ALL the points which we have created and wish to display.
-struct Point *AllPoints = NULL;
-// CurrentPoint points to the last node of the linked list.
-struct Point *CurrentPoint = NULL;
+// PointRandom places the random points (see pointrandom.h). Like rand(),
+// it makes the same points every run until it is seeded (SeedRandom).
+struct PointRandom PointRandom = {{0x9E3779B9, 0x243F6A88, 0xB7E15162, 0x6A09E667}};
+
+// The canvas is made of two cell grids:
+// FrontBuffer mirrors what the terminal is currently showing, and
+// BackBuffer holds the frame we are drawing. PresentFrame() only sends
+// the cells which differ between the two.
+//
+// FrameWidth and FrameHeight are the size of the grids. They are only
+// updated by BeginFrame(), so a SIGWINCH arriving in the middle of a frame
+// cannot change the bounds we are drawing into.
+static struct Cell *FrontBuffer = NULL;
+static struct Cell *BackBuffer = NULL;
+static int FrameWidth = 0;
+static int FrameHeight = 0;
+
+// Points holds ALL the points which we have created and wish to display.
+struct PointStore Points = {.FreeSlot = NO_SLOT};
+
+// A PlotBackend decides what becomes of the frames we draw.
+// Drawing (PlotChar, GeneralizedPlotLine, ...) always goes into the back
+// buffer; PresentFrame() then hands the frame to the backend:
+//   terminal - encodes the changed cells as VT100 output (the default)
+//   memory   - copies the frame into the front buffer, which then holds
+//              the rendered frame, without encoding anything
+//   null     - discards the frame
+// The VT100 helpers below go through the backend as well, so the
+// offscreen backends never write to stdout.
+struct PlotBackend {
+  const char *Name;
+  // Show the back buffer, and bring the front buffer up to date (if the
+  // backend keeps one). Stores the number of cells sent in *Changed, and
+  // returns the number of bytes written.
+  size_t (*Present)(int *Changed);
+  // Send a control sequence (e.g., clear the screen) to the display.
+  void (*Control)(const char *Sequence);
+};
+
+// Defined with the frame buffer utilities.
+struct PlotBackend TerminalBackend;
+struct PlotBackend *Backend = &TerminalBackend;
 
 /* BEGIN VT100 Helper Functions */
 
 // Set Color of Text.
 void SetTextColor(int Color) {
-  printf("\e[%dm", Color);
-  fflush(stdout);
+  char Seq[16];
+  snprintf(Seq, sizeof(Seq), "\e[%dm", Color);
+  Backend->Control(Seq);
 }
 
 
 // Resets terminal to initial state
 void ResetTerminal() {
-  printf("\ec");
-  fflush(stdout);
+  Backend->Control("\ec");
+  EncoderInvalidate(&Encoder);
+  StopAsyncOutput(&Output);
 }
 
 // Sets the cursor at the X (i.e., col) and Y (i.e., row) of the
 // terminal
 void SetCursorAt(int X, int Y) {
-  printf("\e[%d;%dH", Y, X);
-  fflush(stdout);
+  char Seq[24];
+  snprintf(Seq, sizeof(Seq), "\e[%d;%dH", Y, X);
+  Backend->Control(Seq);
 }
 
-// Provided with a coordinate (X,Y), a Color (e.g., color code for blue) 
-// and Dispchar (e.g., '@'), plot it on the terminal.
-void PlotChar(int X, int Y, char Color, char Dispchar) {
-  printf("\e[%2dm\e[%d;%dH%c\e[0m", Color, Y, X, Dispchar);
-  fflush(stdout);
-}
 
 // Clear the screen
-void ClearTerminal() {
-  printf("\e[2J");
-  fflush(stdout);
-}
+void ClearTerminal() { Backend->Control("\e[2J"); }
 
 // Hide the cursor
-void HideCursor() {
-  printf("\e[?25l");
-  fflush(stdout);
-}
+void HideCursor() { Backend->Control("\e[?25l"); }
 
 // Show the cursor
-void ShowCursor() {
-  printf("\e[?25h");
-  fflush(stdout);
-}
+void ShowCursor() { Backend->Control("\e[?25h"); }
 
 // Here, we can probe the Kernel for the current terminal
 // size.
@@ -125,22 +217,351 @@ void ShowCursor() {
 //             Get window size.
 void GetTerminalSize() {
   struct winsize w;
-  ioctl(0, TIOCGWINSZ, &w);
+  char *Columns, *Lines;
+  // If stdin is not a terminal (e.g., when drawing offscreen), use
+  // COLUMNS and LINES if they are set, or keep the previous size.
+  if (ioctl(0, TIOCGWINSZ, &w) == -1 || !w.ws_col || !w.ws_row) {
+    Columns = getenv("COLUMNS");
+    Lines = getenv("LINES");
+    if (Columns && atoi(Columns) > 0)
+      XRange = atoi(Columns);
+    if (Lines && atoi(Lines) > 0)
+      YRange = atoi(Lines);
+    return;
+  }
   XRange = w.ws_col;
   YRange = w.ws_row;
 }
 
+/* END VT100 Helper Functions */
+
+
+/* BEGIN Frame Buffer Utilities */
+
+// Fill Count cells starting at Cells with blanks.
+void BlankCells(struct Cell *Cells, int Count) {
+  int i;
+  for (i = 0; i < Count; ++i) {
+    Cells[i].Sym = BLANK_SYM;
+    Cells[i].Color = BLANK_COLOR;
+  }
+}
+
+// Forget what the terminal shows (e.g., after a frame did not reach it
+// completely): the next frame sends every cell again.
+void InvalidateFrontBuffer() {
+  int i;
+  for (i = 0; i < FrameWidth * FrameHeight; ++i)
+    FrontBuffer[i].Sym = UNKNOWN_SYM;
+  EncoderInvalidate(&Encoder);
+}
+
+// Release both cell grids.
+void ReleaseFrame() {
+  free(FrontBuffer);
+  free(BackBuffer);
+  FrontBuffer = NULL;
+  BackBuffer = NULL;
+  FrameWidth = 0;
+  FrameHeight = 0;
+}
+
+// (Re)allocate blank cell grids of the given size, without
+// touching the terminal. Returns 0 if the grids could not be created.
+int AllocateFrame(int Width, int Height) {
+  struct Cell *Front;
+  struct Cell *Back;
+
+  Front = (struct Cell *)malloc(sizeof(struct Cell) * Width * Height);
+  Back = (struct Cell *)malloc(sizeof(struct Cell) * Width * Height);
+  // Keep drawing into the old grids if we cannot create new ones.
+  if (!Front || !Back) {
+    free(Front);
+    free(Back);
+    return 0;
+  }
+
+  ReleaseFrame();
+  FrontBuffer = Front;
+  BackBuffer = Back;
+  FrameWidth = Width;
+  FrameHeight = Height;
+  BlankCells(FrontBuffer, Width * Height);
+  BlankCells(BackBuffer, Width * Height);
+  // Nothing is left to erase on the new grids.
+  ResizeFootprint(&Footprint, (size_t)Width * Height);
+  return 1;
+}
+
+// (Re)allocate the cell grids to match the terminal size.
+// The terminal is physically cleared, so the front buffer
+// starts out blank as well.
+void ResizeFrame(int Width, int Height) {
+  if (AllocateFrame(Width, Height))
+    ClearTerminal();
+}
+
+// BeginFrame should be called at the start of every frame:
+// if the terminal has been resized since the last frame, the grids
+// are resized (which also clears the terminal).
+void BeginFrame() {
+  int Width = XRange;
+  int Height = YRange;
+  if (Width != FrameWidth || Height != FrameHeight)
+    ResizeFrame(Width, Height);
+}
+
+// Erase everything drawn into the back buffer.
+void ClearFrame() { BlankCells(BackBuffer, FrameWidth * FrameHeight); }
+
+// Provided with a coordinate (X,Y), a Color (e.g., color code for blue) 
+// and Dispchar (e.g., '@'), plot it into the back buffer.
+// Nothing reaches the terminal until PresentFrame() is called.
+// Coordinates outside of the frame are clipped.
+void PlotChar(int X, int Y, char Color, char Dispchar) {
+  struct Cell *C;
+  if (X < 1 || Y < 1 || X > FrameWidth || Y > FrameHeight)
+    return;
+  C = &BackBuffer[(Y - 1) * FrameWidth + (X - 1)];
+  C->Sym = Dispchar;
+  C->Color = Color;
+  if (Footprint.Recording)
+    RecordCell(&Footprint, 0, C - BackBuffer);
+}
+
+// Re-sending a few unchanged cells is often cheaper than moving the
+// cursor over them. This is only done if the cells look the same in
+// the current color (i.e., they have that color, or are blank).
+#define MAX_BRIDGED_CELLS 4
+
+// Returns 1 if the cells of the front buffer between the cursor and
+// column X (on the cursor's row) were re-sent.
+int BridgeGap(struct Cell *Row, int X) {
+  int i;
+  int From = Encoder.CursorX;
+  struct Cell *C;
+
+  if (Encoder.CursorY == CURSOR_UNKNOWN || From == CURSOR_UNKNOWN || From > X ||
+      X - From > MAX_BRIDGED_CELLS || X - From >= MoveCost(&Encoder, X, Encoder.CursorY))
+    return 0;
+
+  for (i = From; i < X; ++i) {
+    C = &Row[i - 1];
+    if (C->Sym != BLANK_SYM && C->Color != Encoder.Color)
+      return 0;
+  }
+  for (i = From; i < X; ++i)
+    EncodeChar(&Encoder, Row[i - 1].Sym);
+  return 1;
+}
+
+// Returns the number of blank cells in Row, starting at column X.
+int BlankRun(struct Cell *Row, int X) {
+  int Run = 0;
+  while (X + Run <= FrameWidth && Row[X + Run - 1].Sym == BLANK_SYM)
+    Run++;
+  return Run;
+}
+
+// If the changed cell at (X, Y) starts a long enough run of blanks,
+// erase the whole run with EL (if it reaches the end of the line) or ECH,
+// instead of sending a space for every cell.
+// Returns the number of cells erased (0 if the run was too short).
+int EraseRun(struct Cell *Front, struct Cell *Back, int X, int Y) {
+  int i;
+  int Run = BlankRun(Back, X);
+
+  if (X + Run - 1 == FrameWidth && Run > 3) {
+    EncodeMoveTo(&Encoder, X, Y);
+    EncodeEraseLine(&Encoder);
+  } else if (Run > 2 * CSICost(Run)) {
+    // The cursor stays at X, so the next change also needs a move.
+    EncodeMoveTo(&Encoder, X, Y);
+    EncodeEraseChars(&Encoder, Run);
+  } else {
+    return 0;
+  }
+
+  for (i = X; i < X + Run; ++i)
+    Front[i - 1] = Back[i - 1];
+  return Run;
+}
+
+// Blank the cells of the previous frame (see ClearPointLoop) which the
+// current frame has not drawn over. Only the recorded cells are looked at,
+// unless some of them could not be recorded.
+void EraseFootprint() {
+  int i, j;
+  uint32_t Cell;
+  struct FootprintList *L;
+
+  if (Footprint.PendingOverflow) {
+    for (Cell = 0; Cell < (uint32_t)(FrameWidth * FrameHeight); ++Cell)
+      if (!DrawnThisFrame(&Footprint, Cell))
+        BlankCells(&BackBuffer[Cell], 1);
+    Footprint.PendingOverflow = 0;
+  } else {
+    for (i = 0; i < FOOTPRINT_LISTS; ++i) {
+      L = &Footprint.Pending[i];
+      for (j = 0; j < L->Count; ++j)
+        if (!DrawnThisFrame(&Footprint, L->Cells[j]))
+          BlankCells(&BackBuffer[L->Cells[j]], 1);
+    }
+  }
+  for (i = 0; i < FOOTPRINT_LISTS; ++i)
+    Footprint.Pending[i].Count = 0;
+}
+
+// Terminal backend: compare the back buffer against the front buffer
+// (what the terminal is currently displaying), and only send the cells
+// that have changed.
+// The whole frame is encoded into one buffer and sent with a single
+// write (or queued, see asyncoutput.h). Returns the number of bytes sent.
+// If the terminal has not taken the frames queued before, the frame is
+// skipped: the front buffer is left alone, so the next frame sends its
+// changes too. If a frame does not reach the terminal completely, the
+// front buffer is invalidated, and the next frame repaints everything.
+size_t TerminalPresent(int *Changed) {
+  int X, Y, Erased;
+  size_t Bytes;
+  struct Cell *Front;
+  struct Cell *Back;
+
+  if (OutputBusy(&Output)) {
+    Output.Skipped++;
+    return 0;
+  }
+
+  BeginPhase(PHASE_ENCODE);
+  EncoderBegin(&Encoder, FrameWidth, FrameHeight);
+  for (Y = 1; Y <= FrameHeight; ++Y) {
+    Front = &FrontBuffer[(Y - 1) * FrameWidth];
+    Back = &BackBuffer[(Y - 1) * FrameWidth];
+    for (X = 1; X <= FrameWidth; ++X) {
+      if (Front[X - 1].Sym == Back[X - 1].Sym &&
+          Front[X - 1].Color == Back[X - 1].Color)
+        continue;
+      if (Back[X - 1].Sym == BLANK_SYM && (Erased = EraseRun(Front, Back, X, Y))) {
+        *Changed += Erased;
+        X += Erased - 1;
+        continue;
+      }
+      if (Encoder.CursorY != Y || !BridgeGap(Front, X))
+        EncodeMoveTo(&Encoder, X, Y);
+      // The color of a blank does not matter.
+      if (Back[X - 1].Sym != BLANK_SYM)
+        EncodeColor(&Encoder, Back[X - 1].Color);
+      EncodeChar(&Encoder, Back[X - 1].Sym);
+      Front[X - 1] = Back[X - 1];
+      (*Changed)++;
+    }
+  }
+  EndPhase(PHASE_ENCODE);
+
+  BeginPhase(PHASE_WRITE);
+  Bytes = SendFrame(&Output, &Encoder);
+  if (Encoder.LastFrameLost || TakeLostFrames(&Output))
+    InvalidateFrontBuffer();
+  EndPhase(PHASE_WRITE);
+  return Bytes;
+}
+
+void TerminalControl(const char *Sequence) {
+  // Frames still queued go out first.
+  DrainOutput(&Output);
+  fputs(Sequence, stdout);
+  fflush(stdout);
+}
+
+// Memory backend: the front buffer becomes the rendered frame.
+size_t MemoryPresent(int *Changed) {
+  int i;
+  BeginPhase(PHASE_ENCODE);
+  for (i = 0; i < FrameWidth * FrameHeight; ++i) {
+    if (FrontBuffer[i].Sym == BackBuffer[i].Sym &&
+        FrontBuffer[i].Color == BackBuffer[i].Color)
+      continue;
+    FrontBuffer[i] = BackBuffer[i];
+    (*Changed)++;
+  }
+  EndPhase(PHASE_ENCODE);
+  return 0;
+}
+
+// Null backend: frames go nowhere.
+size_t NullPresent(int *Changed) {
+  (void)Changed;
+  return 0;
+}
+
+void NullControl(const char *Sequence) { (void)Sequence; }
+
+struct PlotBackend TerminalBackend = {"terminal", TerminalPresent, TerminalControl};
+struct PlotBackend MemoryBackend = {"memory", MemoryPresent, NullControl};
+struct PlotBackend NullBackend = {"null", NullPresent, NullControl};
+
+// Select the backend called Name. Returns 0 (and keeps the current
+// backend) if there is no such backend.
+int SelectPlotBackend(const char *Name) {
+  struct PlotBackend *Backends[] = {&TerminalBackend, &MemoryBackend, &NullBackend};
+  int i;
+  for (i = 0; i < (int)(sizeof(Backends) / sizeof(Backends[0])); ++i) {
+    if (!strcmp(Name, Backends[i]->Name)) {
+      Backend = Backends[i];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Hand the back buffer to the backend (see PlotBackend).
+// Returns the number of bytes written.
+size_t PresentFrame() {
+  int Changed = 0;
+  unsigned long Skipped = Output.Skipped;
+  size_t Bytes;
+
+  // Carry out the erase queued by ClearPointLoop (if any).
+  BeginPhase(PHASE_ERASE);
+  EraseFootprint();
+  EndPhase(PHASE_ERASE);
+  Bytes = Backend->Present(&Changed);
+  // A skipped frame sent nothing, but it is not a frame of 0 bytes.
+  if (Output.Skipped != Skipped)
+    CountSkippedFrame();
+  else
+    CountFrame(Bytes, Changed);
+  return Bytes;
+}
+
 // The terminal will be cleared, and the cursor
 // will be hidden.
+// Set PLOT_BACKEND to "memory" or "null" to draw offscreen instead, and
+// PLOT_OUTPUT to "async" or "thread" to send the frames asynchronously
+// (see asyncoutput.h), POINT_COLLISIONS=1 to make the points bounce
+// off each other (see collision.h), and POLYGON_FILL to fill the loop of
+// points (see polygonfill.h).
 void InitializeTerminal() {
-  ColorSelector = rand()%NUM_COLORS;
-  CharacterSelector = rand()%NUM_LETTERS;
+  char *Name = getenv("PLOT_BACKEND");
+  char *Mode = getenv("PLOT_OUTPUT");
+  char *Collide = getenv("POINT_COLLISIONS");
+  char *Fill = getenv("POLYGON_FILL");
+  if (Name && !SelectPlotBackend(Name))
+    fprintf(stderr, "Unknown PLOT_BACKEND: %s\n", Name);
+  if (Mode && strcmp(Mode, "sync") && !StartAsyncOutput(&Output, Encoder.OutputFD, Mode))
+    fprintf(stderr, "Cannot use PLOT_OUTPUT=%s, writing synchronously\n", Mode);
+  Collisions.Enabled = Collide && atoi(Collide);
+  if (Fill && !SelectPolygonFill(&PolygonFill, Fill))
+    fprintf(stderr, "Unknown POLYGON_FILL: %s\n", Fill);
+  ColorSelector = RandomBelow(&PointRandom, NUM_COLORS);
+  CharacterSelector = RandomBelow(&PointRandom, NUM_LETTERS);
   HideCursor();
-  ClearTerminal();
   GetTerminalSize();
+  // Creating the frame also clears the terminal.
+  ResizeFrame(XRange, YRange);
 }
 
-/* END VT100 Helper Functions */
+/* END Frame Buffer Utilities */
 
 
 /* BEGIN Plot Utilities */
@@ -148,160 +569,329 @@ void InitializeTerminal() {
 // Some NOTES:
 // Top Left Corner is 1,1: https://en.wikipedia.org/wiki/ANSI_escape_code
 
+// Grow the point arrays (by doubling them) so they can hold at least
+// Needed points. Returns 0 if the memory could not be allocated.
+int ReservePoints(int Needed) {
+  int NewCapacity;
+  void *Grown;
+
+  if (Needed <= Points.Capacity)
+    return 1;
+
+  NewCapacity = Points.Capacity ? Points.Capacity : INITIAL_POINT_CAPACITY;
+  while (NewCapacity < Needed)
+    NewCapacity <<= 1;
+
+  // Each array is updated as soon as it has been grown, so a failure part of
+  // the way through leaves every array at least Capacity entries long.
+#define GROW_FIELD(Field)                                                      \
+  Grown = realloc(Points.Field, sizeof(*Points.Field) * NewCapacity);          \
+  if (!Grown)                                                                  \
+    return 0;                                                                  \
+  Points.Field = Grown;
+
+  GROW_FIELD(X)
+  GROW_FIELD(Y)
+  GROW_FIELD(dX)
+  GROW_FIELD(dY)
+  GROW_FIELD(Color)
+  GROW_FIELD(Sym)
+  GROW_FIELD(Slot)
+  // There are never more slots than the most points we have had.
+  GROW_FIELD(SlotIndex)
+  GROW_FIELD(SlotGeneration)
+#undef GROW_FIELD
+
+  Points.Capacity = NewCapacity;
+  return 1;
+}
+
+// Returns the handle of the point at index i.
+struct PointHandle PointHandleAt(int i) {
+  struct PointHandle H;
+  H.Slot = Points.Slot[i];
+  H.Generation = Points.SlotGeneration[H.Slot];
+  return H;
+}
+
+// Returns the index of the point named by H, or -1 if
+// that point has been removed.
+int LookupPoint(struct PointHandle H) {
+  if (H.Slot >= Points.NumSlots || Points.SlotGeneration[H.Slot] != H.Generation)
+    return -1;
+  return Points.SlotIndex[H.Slot];
+}
+
+// Take a slot for a new point: a free slot if there is one.
+// (ReservePoints must have made room for the point.)
+uint32_t TakeSlot() {
+  uint32_t Slot;
+  if (Points.FreeSlot != NO_SLOT) {
+    Slot = Points.FreeSlot;
+    Points.FreeSlot = Points.SlotIndex[Slot];
+  } else {
+    Slot = Points.NumSlots++;
+    Points.SlotGeneration[Slot] = 1;
+  }
+  return Slot;
+}
+
+// GenPoint allows the user to manually specify all of the fields
+// of a newly created point (which is then added to Points).
+// The user is responsible for geneting valid coordinates...
+// Returns the handle of the new point, or NO_POINT if it could not be created.
+struct PointHandle GenPoint(int X, int Y, int dX, int dY, int Color, int Sym) {
+  int i;
+  uint32_t Slot;
+
+  if (!ReservePoints(Points.Count + 1))
+    return NO_POINT;
+
+  Slot = TakeSlot();
+  i = Points.Count++;
+  Points.X[i] = X;
+  Points.Y[i] = Y;
+  Points.dX[i] = dX;
+  Points.dY[i] = dY;
+  Points.Color[i] = Color;
+  Points.Sym[i] = Sym;
+  Points.Slot[i] = Slot;
+  Points.SlotIndex[Slot] = i;
+  ForgetLastCells(&Collisions);
+  return PointHandleAt(i);
+}
+
 // GenRandPoint will generate a random point within the terminal window.
-void GenRandPoint() {
-  
-  // First, Ask Malloc to create a new node.
-  struct Point *NewPt = (struct Point *)malloc(sizeof(struct Point));
-  // Return if we cannot create a new node.
-  if (!NewPt)
-    return;
-  // Now, fill in the fields of the newly created struct.
+// Returns the handle of the new point, or NO_POINT if it could not be created.
+struct PointHandle GenRandPoint() {
+  int X, Y, dX, dY, Color, Sym;
+  uint32_t Direction;
+
   // Here, we randomly select between (1 .. XRange) and (1 .. YRange)
   // for the coordinates.
-  NewPt->X = rand() % (XRange)+1;
-  NewPt->Y = rand() % (YRange)+1;
-  // We also randomly choose to move each point in 
-  // one of the four diagonal directions.
-  if(NewPt->X == 1)
-    NewPt->dX = 1;
-  else if(NewPt->X == XRange)
-    NewPt->dX = -1;
+  X = RandomBelow(&PointRandom, XRange) + 1;
+  Y = RandomBelow(&PointRandom, YRange) + 1;
+  // We also randomly choose to move each point in
+  // one of the four diagonal directions (a bit for each axis).
+  Direction = NextRandom(&PointRandom);
+  if(X == 1)
+    dX = 1;
+  else if(X == XRange)
+    dX = -1;
   else
-    NewPt->dX = ((rand() % 100) > 50) ? 1 : -1;
+    dX = (Direction & 1) ? 1 : -1;
 
-  if(NewPt->Y == 1)
-    NewPt->dY = 1;
-  else if(NewPt->Y == YRange)
-    NewPt->dY = -1;
+  if(Y == 1)
+    dY = 1;
+  else if(Y == YRange)
+    dY = -1;
   else
-    NewPt->dY = ((rand() % 100) > 50) ? 1 : -1;
-
+    dY = (Direction & 2) ? 1 : -1;
 
   // Select a color.
-  NewPt->Color = Colors[ColorSelector%NUM_COLORS];
+  Color = Colors[ColorSelector%NUM_COLORS];
   ColorSelector++;
   // Generate a symbol between 'A' and 'Z'
-  NewPt->Sym = 'A' + CharacterSelector%NUM_LETTERS;
+  Sym = 'A' + CharacterSelector%NUM_LETTERS;
   CharacterSelector++;
-  // Set the NextPoint to NULL
-  NewPt->Next = NULL;
-
-  // If this is the first time we've entered this function,
-  // AllPoints would have been NULL.
-  if (!AllPoints) {
-    AllPoints = NewPt;
-    CurrentPoint = AllPoints;
-    return;
-  }
-  // Otherwise, CurrentPoint will be updated by linking in the new node.
-  CurrentPoint->Next = NewPt;
-  CurrentPoint = NewPt;
-}
 
+  return GenPoint(X, Y, dX, dY, Color, Sym);
+}
 
-// GenPoint allows the user to manually specify all of the fields
-// of a newly created point (which is then linked into the global
-// pointers).
-// The user is responsible for geneting valid coordinates...
-void GenPoint(int X, int Y, int dX, int dY, int Color, int Sym) {
-  struct Point *NewPt = (struct Point *)malloc(sizeof(struct Point));
-  if (!NewPt)
-    return;
-
-  NewPt->X = X;
-  NewPt->Y = Y;
-  NewPt->dX = dX;
-  NewPt->dY = dY;
-  NewPt->Color = Color;
-  NewPt->Sym = Sym;
-  NewPt->Next = NULL;
-
-  if (!AllPoints) {
-    AllPoints = NewPt;
-    CurrentPoint = AllPoints;
-    return;
+// GenRandPoints generates Count random points at once, like as many calls
+// to GenRandPoint would (but not the same points): the coordinates and
+// directions come out of FillRandomPoints, and the colors, symbols and
+// slots are filled in one more pass.
+// Returns the number of points created (0 if they could not be allocated).
+int GenRandPoints(int Count) {
+  int First = Points.Count;
+  int i, Color, Letter;
+  uint32_t Slot;
+
+  if (Count <= 0 || !ReservePoints(First + Count))
+    return 0;
+
+  FillRandomPoints(&PointRandom, &Points.X[First], &Points.Y[First], &Points.dX[First],
+                   &Points.dY[First], Count, XRange, YRange);
+
+  Color = ColorSelector % NUM_COLORS;
+  Letter = CharacterSelector % NUM_LETTERS;
+  for (i = First; i < First + Count; ++i) {
+    Points.Color[i] = Colors[Color];
+    Points.Sym[i] = 'A' + Letter;
+    if (++Color == NUM_COLORS)
+      Color = 0;
+    if (++Letter == NUM_LETTERS)
+      Letter = 0;
+    Slot = TakeSlot();
+    Points.Slot[i] = Slot;
+    Points.SlotIndex[Slot] = i;
   }
-
-  CurrentPoint->Next = NewPt;
-  CurrentPoint = NewPt;
+  ColorSelector += Count;
+  CharacterSelector += Count;
+  Points.Count += Count;
+  ForgetLastCells(&Collisions);
+  return Count;
 }
 
-// UpdatePoints will update each point in the Point Linked List
-// (i.e., AllPoints) by adding the change in X (dX) and Y (dX) to the 
-// the X and Y coordinates.
+// UpdatePoints will update each point in Points by adding the
+// change in X (dX) and Y (dX) to the the X and Y coordinates.
 // We check for boundary conditions here: if we are 1 away from the XRange/YRange
 // or 0/0, then we need to flip the sign on dX and dY (move away from the boundaries)
+//
+// Both axes go through BounceAxis (see pointkernels.h), which
+// handles many points at once without branching.
+//
+// With collisions on (see collision.h), the points also bounce off each
+// other.
 void UpdatePoints() {
-  struct Point *Tmp = AllPoints;
-  while (Tmp) {
-    // Update the points.
-    Tmp->X += Tmp->dX;
-    Tmp->Y += Tmp->dY;
-
-    // Check if we need to flip our directions.
-    if (Tmp->X <= 1) {
-      Tmp->dX = 1;
-    }
-
-    if (Tmp->X >= XRange) {
-      Tmp->dX = -1;
-    }
-
-    if (Tmp->Y <= 1) {
-      Tmp->dY = 1;
-    }
-
-    if (Tmp->Y >= YRange) {
-      Tmp->dY = -1;
-    }
+  BounceAxis(Points.X, Points.dX, Points.Count, XRange);
+  BounceAxis(Points.Y, Points.dY, Points.Count, YRange);
+  if (Collisions.Enabled)
+    CollidePoints(&Collisions, Points.X, Points.Y, Points.dX, Points.dY, Points.Count, XRange,
+                  YRange);
+}
 
-    Tmp = Tmp->Next;
+// Remove the point at index i in O(1): the last point is moved into
+// its place, and its slot is put back on the free list.
+// The memory is kept around for the next point we create.
+// NOTE: Moving the last point reorders the loop (see NextInLoop): it now
+// runs P(i-1) -> old last point -> P(i+1). Only removing the last point
+// (DeleteLastPoint) keeps the rest of the loop as it was.
+void DeletePointAt(int i) {
+  int Last = Points.Count - 1;
+  uint32_t Slot = Points.Slot[i];
+
+  if (i != Last) {
+    Points.X[i] = Points.X[Last];
+    Points.Y[i] = Points.Y[Last];
+    Points.dX[i] = Points.dX[Last];
+    Points.dY[i] = Points.dY[Last];
+    Points.Color[i] = Points.Color[Last];
+    Points.Sym[i] = Points.Sym[Last];
+    Points.Slot[i] = Points.Slot[Last];
+    Points.SlotIndex[Points.Slot[i]] = i;
   }
+  Points.Count--;
+  ForgetLastCells(&Collisions);
+
+  // Invalidate every handle to this slot (skipping generation 0).
+  if (++Points.SlotGeneration[Slot] == 0)
+    Points.SlotGeneration[Slot] = 1;
+  Points.SlotIndex[Slot] = Points.FreeSlot;
+  Points.FreeSlot = Slot;
+}
+
+// Remove the point named by H (which reorders the loop, like
+// DeletePointAt).
+// Returns 1 if it was removed, or 0 if it had already been removed.
+int DeletePoint(struct PointHandle H) {
+  int i = LookupPoint(H);
+  if (i < 0)
+    return 0;
+  DeletePointAt(i);
+  return 1;
 }
 
 // As the title suggests, this function
-// will remove the last point of AllPoints.
+// will remove the last point of Points.
 void DeleteLastPoint() {
-  struct Point *Tmp1 = AllPoints;
-  struct Point *Tmp2;
+  if (Points.Count > 0)
+    DeletePointAt(Points.Count - 1);
+}
 
-  // Nothing to free.
-  if (!AllPoints)
-    return;
+// Remove all of the points, and release their memory.
+void DeletePoints() {
+  free(Points.X);
+  free(Points.Y);
+  free(Points.dX);
+  free(Points.dY);
+  free(Points.Color);
+  free(Points.Sym);
+  free(Points.Slot);
+  free(Points.SlotIndex);
+  free(Points.SlotGeneration);
+  Points = EMPTY_POINT_STORE;
+  ReleaseCollisionGrid(&Collisions);
+  ReleasePolygonFill(&PolygonFill);
+}
 
-  // Only the head of the list remains
-  if (!AllPoints->Next) {
-    free(AllPoints);
-    AllPoints = NULL;
-    CurrentPoint = NULL;
-    return;
-  }
+// Points form a closed loop: P(i) connects to P(i+1), and the last point
+// wraps around to P(0) (unless there are only two points, which are
+// already connected to each other). The loop follows the indices, so it
+// changes shape when a point other than the last is removed.
+// Returns the index of the point that P(i) connects to, or -1.
+int NextInLoop(int i) {
+  if (i + 1 < Points.Count)
+    return i + 1;
+  if (Points.Count != 2)
+    return 0;
+  return -1;
+}
 
-  // Travel through the list.
-  while (Tmp1->Next) {
-    Tmp2 = Tmp1;
-    Tmp1 = Tmp1->Next;
-  }
-  free(Tmp2->Next);
-  Tmp2->Next = NULL;
-  CurrentPoint = Tmp2;
+void PlotPoint(int i) {
+  PlotChar(Points.X[i], Points.Y[i], Points.Color[i], Points.Sym[i]);
 }
 
-void DeletePoints() {
-  struct Point *Tmp;
-  while (AllPoints) {
-    Tmp = AllPoints;
-    AllPoints = AllPoints->Next;
-    free(Tmp);
+// Fill the cells (X0, Y) .. (X1, Y) of the back buffer.
+// The run is clipped to the frame once, rather than for every cell.
+void PlotHSpan(int X0, int X1, int Y, int Color, char Sym) {
+  int Tmp;
+  struct Cell *C;
+  struct Cell *End;
+
+  if (X0 > X1) {
+    Tmp = X0;
+    X0 = X1;
+    X1 = Tmp;
+  }
+  if (Y < 1 || Y > FrameHeight || X1 < 1 || X0 > FrameWidth)
+    return;
+  if (X0 < 1)
+    X0 = 1;
+  if (X1 > FrameWidth)
+    X1 = FrameWidth;
+
+  C = &BackBuffer[(Y - 1) * FrameWidth + (X0 - 1)];
+  End = C + (X1 - X0 + 1);
+  for (; C < End; ++C) {
+    C->Sym = Sym;
+    C->Color = Color;
+    if (Footprint.Recording)
+      RecordCell(&Footprint, 0, C - BackBuffer);
   }
-  AllPoints = NULL;
-  CurrentPoint = NULL;
 }
 
-void PlotPoint(struct Point *Pt) { PlotChar(Pt->X, Pt->Y, Pt->Color, Pt->Sym); }
+// Fill the cells (X, Y0) .. (X, Y1) of the back buffer.
+void PlotVSpan(int X, int Y0, int Y1, int Color, char Sym) {
+  int Tmp;
+  struct Cell *C;
+  struct Cell *End;
+
+  if (Y0 > Y1) {
+    Tmp = Y0;
+    Y0 = Y1;
+    Y1 = Tmp;
+  }
+  if (X < 1 || X > FrameWidth || Y1 < 1 || Y0 > FrameHeight)
+    return;
+  if (Y0 < 1)
+    Y0 = 1;
+  if (Y1 > FrameHeight)
+    Y1 = FrameHeight;
+
+  C = &BackBuffer[(Y0 - 1) * FrameWidth + (X - 1)];
+  End = C + (Y1 - Y0 + 1) * FrameWidth;
+  for (; C < End; C += FrameWidth) {
+    C->Sym = Sym;
+    C->Color = Color;
+    if (Footprint.Recording)
+      RecordCell(&Footprint, 0, C - BackBuffer);
+  }
+}
 
 // Follows Bresenham's Algorithm (this ver. is valid for ALL quadrants.)
+// Horizontal and vertical lines are handed to PlotHSpan/PlotVSpan.
 void GeneralizedPlotLine(int X0, int Y0, int X1, int Y1, int Color, char Sym) {
   // Absolute change in X
   int dX = abs(X1 - X0);
@@ -316,6 +906,15 @@ void GeneralizedPlotLine(int X0, int Y0, int X1, int Y1, int Color, char Sym) {
   int E = dX + dY;
   int DoubleE;
 
+  if (Y0 == Y1) {
+    PlotHSpan(X0, X1, Y0, Color, Sym);
+    return;
+  }
+  if (X0 == X1) {
+    PlotVSpan(X0, Y0, Y1, Color, Sym);
+    return;
+  }
+
   for (;;) {
     PlotChar(X0, Y0, Color, Sym);
     DoubleE = E << 1;
@@ -343,7 +942,58 @@ void PlotLine(int X0, int Y0, int X1, int Y1, int Color) {
 
 
 void ClearLine(int X0, int Y0, int X1, int Y1) {
-  GeneralizedPlotLine(X0, Y0, X1, Y1, BLACK, ' ');
+  GeneralizedPlotLine(X0, Y0, X1, Y1, BLANK_COLOR, BLANK_SYM);
+}
+
+// The closed loop of points may have many lines, which are drawn by the
+// tile rasterizer (using PLOT_THREADS threads, see tileraster.h).
+#include "tileraster.h"
+
+// Draw the closed loop of points: every point is connected to the next
+// (see NextInLoop) with a line of its own color, and the points are
+// drawn on top of the lines. With POLYGON_FILL set, the polygon is
+// filled (in the color of P(0)) underneath.
+// If ShowLines is 0, only the points are drawn.
+void PlotPointLoop(int ShowLines) {
+  int i, j;
+  if (ShowLines && Points.Count >= 3)
+    FillPolygon(&PolygonFill, Points.X, Points.Y, Points.Count, FrameHeight, Points.Color[0],
+                PolygonFill.Sym, PlotHSpan);
+  ForEachPoint(i) {
+    if (ShowLines) {
+      j = NextInLoop(i);
+      if (j >= 0)
+        BatchLine(Points.X[i], Points.Y[i], Points.X[j], Points.Y[j],
+                  Points.Color[i], '*');
+      // The line that closes the loop is drawn over P(0).
+      if (j == 0)
+        BatchChar(Points.X[0], Points.Y[0], Points.Color[0], Points.Sym[0]);
+    }
+    BatchChar(Points.X[i], Points.Y[i], Points.Color[i], Points.Sym[i]);
+  }
+  RunRasterBatch();
+}
+
+// Draw over every line of the closed loop of points.
+// If the footprint is being recorded (see RecordFootprint), the cells
+// drawn since the last call are erased instead: the erase happens in
+// the next PresentFrame(), and skips the cells drawn again by then.
+void ClearPointLoop() {
+  int i, j;
+  if (Footprint.Recording) {
+    NextFootprint(&Footprint);
+    return;
+  }
+  if (Points.Count >= 3)
+    FillPolygon(&PolygonFill, Points.X, Points.Y, Points.Count, FrameHeight, BLANK_COLOR,
+                BLANK_SYM, PlotHSpan);
+  ForEachPoint(i) {
+    j = NextInLoop(i);
+    if (j >= 0)
+      BatchLine(Points.X[i], Points.Y[i], Points.X[j], Points.Y[j], BLANK_COLOR,
+                BLANK_SYM);
+  }
+  RunRasterBatch();
 }
 /* END PLOT UTILITIES */
 
@@ -0,0 +1,124 @@
+#ifndef __POINT_KERNELS_H__
+#define __POINT_KERNELS_H__
+
+#include <stdint.h>
+
+// The bounce logic of UpdatePoints() is the same for both axes:
+//
+//   P += dP
+//   if P <= 1     -> dP = 1
+//   if P >= Range -> dP = -1  (this one wins if both are true)
+//
+// so it is written once as a kernel over one axis (X and dX, or Y and dY).
+//
+// BounceAxisScalar is the reference implementation. BounceAxis uses the
+// widest vector unit the compiler was told about (AVX2 or SSE2 on x86,
+// NEON on the Cortex-A9), and falls back to the scalar loop for whatever
+// is left over (or when there is no vector unit at all).
+// Both produce exactly the same results, including the 16-bit wrap-around.
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// Set UseScalarUpdate to 1 to always use the reference implementation.
+static int UseScalarUpdate = 0;
+
+// Name of the kernel selected when this file was compiled.
+#if defined(__AVX2__)
+#define BOUNCE_KERNEL "avx2"
+#elif defined(__SSE2__)
+#define BOUNCE_KERNEL "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BOUNCE_KERNEL "neon"
+#else
+#define BOUNCE_KERNEL "scalar"
+#endif
+
+void BounceAxisScalar(int16_t *P, int16_t *dP, int Start, int Count, int Range) {
+  int i;
+  for (i = Start; i < Count; ++i) {
+    P[i] += dP[i];
+    if (P[i] <= 1)
+      dP[i] = 1;
+    if (P[i] >= Range)
+      dP[i] = -1;
+  }
+}
+
+void BounceAxis(int16_t *P, int16_t *dP, int Count, int Range) {
+  int i = 0;
+  int16_t Last;
+
+  if (UseScalarUpdate) {
+    BounceAxisScalar(P, dP, 0, Count, Range);
+    return;
+  }
+
+  // P >= Range is computed as P > Range - 1. Range is a terminal size
+  // (so at least 1), and no 16-bit P can reach a Range beyond 32767.
+  Last = Range > INT16_MAX ? INT16_MAX : (int16_t)(Range - 1);
+  (void)Last; // Unused when there is no vector unit.
+
+#if defined(__AVX2__)
+  {
+    const __m256i One = _mm256_set1_epi16(1);
+    const __m256i Two = _mm256_set1_epi16(2);
+    const __m256i LastV = _mm256_set1_epi16(Last);
+    __m256i Pos, Dir, Low, High;
+    for (; i + 16 <= Count; i += 16) {
+      Pos = _mm256_loadu_si256((__m256i *)&P[i]);
+      Dir = _mm256_loadu_si256((__m256i *)&dP[i]);
+      Pos = _mm256_add_epi16(Pos, Dir);
+      Low = _mm256_cmpgt_epi16(Two, Pos);    // P <= 1
+      High = _mm256_cmpgt_epi16(Pos, LastV); // P >= Range
+      Dir = _mm256_blendv_epi8(Dir, One, Low);
+      Dir = _mm256_or_si256(Dir, High); // -1 is all ones
+      _mm256_storeu_si256((__m256i *)&P[i], Pos);
+      _mm256_storeu_si256((__m256i *)&dP[i], Dir);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const __m128i One = _mm_set1_epi16(1);
+    const __m128i Two = _mm_set1_epi16(2);
+    const __m128i LastV = _mm_set1_epi16(Last);
+    __m128i Pos, Dir, Low, High;
+    for (; i + 8 <= Count; i += 8) {
+      Pos = _mm_loadu_si128((__m128i *)&P[i]);
+      Dir = _mm_loadu_si128((__m128i *)&dP[i]);
+      Pos = _mm_add_epi16(Pos, Dir);
+      Low = _mm_cmpgt_epi16(Two, Pos);    // P <= 1
+      High = _mm_cmpgt_epi16(Pos, LastV); // P >= Range
+      Dir = _mm_or_si128(_mm_andnot_si128(Low, Dir), _mm_and_si128(Low, One));
+      Dir = _mm_or_si128(Dir, High); // -1 is all ones
+      _mm_storeu_si128((__m128i *)&P[i], Pos);
+      _mm_storeu_si128((__m128i *)&dP[i], Dir);
+    }
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  {
+    const int16x8_t One = vdupq_n_s16(1);
+    const int16x8_t MinusOne = vdupq_n_s16(-1);
+    const int16x8_t LastV = vdupq_n_s16(Last);
+    int16x8_t Pos, Dir;
+    for (; i + 8 <= Count; i += 8) {
+      Pos = vld1q_s16(&P[i]);
+      Dir = vld1q_s16(&dP[i]);
+      Pos = vaddq_s16(Pos, Dir);
+      Dir = vbslq_s16(vcleq_s16(Pos, One), One, Dir);
+      Dir = vbslq_s16(vcgtq_s16(Pos, LastV), MinusOne, Dir);
+      vst1q_s16(&P[i], Pos);
+      vst1q_s16(&dP[i], Dir);
+    }
+  }
+#endif
+
+  BounceAxisScalar(P, dP, i, Count, Range);
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef __POINT_RANDOM_H__
+#define __POINT_RANDOM_H__
+
+#include <stdint.h>
+
+// Random numbers for the points: xoshiro128** (Blackman and Vigna), a
+// small and fast generator with 128 bits of state and 32-bit outputs
+// (cheap on the 32-bit Cortex-A9 too).
+//
+// Unlike rand(), the state is a struct PointRandom of its own: each
+// thread (or scene) can have one, and nothing is shared or locked.
+// JumpRandom() moves a generator 2^64 numbers ahead, which splits one
+// seed into streams that never overlap.
+//
+// RandomLanes runs RANDOM_LANES generators side by side (each on its own
+// stream), so a whole block of numbers comes out of a few vector
+// instructions. Like BounceAxis (see pointkernels.h), it uses the widest
+// vector unit the compiler was told about, and NextRandomLanesScalar is
+// the reference; both produce the same numbers.
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+struct PointRandom {
+  uint32_t S[4];
+};
+
+#define RANDOM_LANES 8
+
+// S[j][k] is word j of the state of lane k.
+struct RandomLanes {
+  uint32_t S[4][RANDOM_LANES];
+};
+
+static inline uint32_t RotateLeft(uint32_t X, int K) { return (X << K) | (X >> (32 - K)); }
+
+// SplitMix64, to spread a seed over the whole state.
+uint64_t SplitMix64(uint64_t *X) {
+  uint64_t Z = (*X += 0x9E3779B97F4A7C15ULL);
+  Z = (Z ^ (Z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  Z = (Z ^ (Z >> 27)) * 0x94D049BB133111EBULL;
+  return Z ^ (Z >> 31);
+}
+
+void SeedRandom(struct PointRandom *R, uint64_t Seed) {
+  uint64_t A = SplitMix64(&Seed);
+  uint64_t B = SplitMix64(&Seed);
+  R->S[0] = (uint32_t)A;
+  R->S[1] = (uint32_t)(A >> 32);
+  R->S[2] = (uint32_t)B;
+  R->S[3] = (uint32_t)(B >> 32);
+  // The state must not be all zeros.
+  if (!(R->S[0] | R->S[1] | R->S[2] | R->S[3]))
+    R->S[0] = 1;
+}
+
+uint32_t NextRandom(struct PointRandom *R) {
+  uint32_t Result = RotateLeft(R->S[1] * 5, 7) * 9;
+  uint32_t T = R->S[1] << 9;
+
+  R->S[2] ^= R->S[0];
+  R->S[3] ^= R->S[1];
+  R->S[1] ^= R->S[2];
+  R->S[0] ^= R->S[3];
+  R->S[2] ^= T;
+  R->S[3] = RotateLeft(R->S[3], 11);
+  return Result;
+}
+
+// A number in 0 .. N - 1 (N > 0), without the bias of a modulo
+// (Lemire's multiply-and-shift, with the rare retry that makes it exact).
+uint32_t RandomBelow(struct PointRandom *R, uint32_t N) {
+  uint64_t M = (uint64_t)NextRandom(R) * N;
+  uint32_t Threshold;
+
+  if ((uint32_t)M < N) {
+    Threshold = -N % N;
+    while ((uint32_t)M < Threshold)
+      M = (uint64_t)NextRandom(R) * N;
+  }
+  return M >> 32;
+}
+
+// Move R 2^64 numbers ahead.
+void JumpRandom(struct PointRandom *R) {
+  static const uint32_t Jump[] = {0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b};
+  uint32_t S[4] = {0, 0, 0, 0};
+  int i, b, j;
+
+  for (i = 0; i < 4; ++i) {
+    for (b = 0; b < 32; ++b) {
+      if (Jump[i] & (1u << b)) {
+        for (j = 0; j < 4; ++j)
+          S[j] ^= R->S[j];
+      }
+      NextRandom(R);
+    }
+  }
+  for (j = 0; j < 4; ++j)
+    R->S[j] = S[j];
+}
+
+// Give every lane of L a stream of its own, split off R (which moves
+// past all of them).
+void SeedRandomLanes(struct RandomLanes *L, struct PointRandom *R) {
+  int j, k;
+  for (k = 0; k < RANDOM_LANES; ++k) {
+    JumpRandom(R);
+    for (j = 0; j < 4; ++j)
+      L->S[j][k] = R->S[j];
+  }
+  JumpRandom(R);
+}
+
+void NextRandomLanesScalar(struct RandomLanes *L, uint32_t *Out) {
+  uint32_t T;
+  int k;
+  for (k = 0; k < RANDOM_LANES; ++k) {
+    Out[k] = RotateLeft(L->S[1][k] * 5, 7) * 9;
+    T = L->S[1][k] << 9;
+    L->S[2][k] ^= L->S[0][k];
+    L->S[3][k] ^= L->S[1][k];
+    L->S[1][k] ^= L->S[2][k];
+    L->S[0][k] ^= L->S[3][k];
+    L->S[2][k] ^= T;
+    L->S[3][k] = RotateLeft(L->S[3][k], 11);
+  }
+}
+
+// The next number of every lane, into Out[0 .. RANDOM_LANES - 1].
+// (x * 5 and x * 9 are shifts and adds, so no vector multiply is needed.)
+void NextRandomLanes(struct RandomLanes *L, uint32_t *Out) {
+#if defined(__AVX2__)
+  __m256i S0 = _mm256_loadu_si256((__m256i *)L->S[0]);
+  __m256i S1 = _mm256_loadu_si256((__m256i *)L->S[1]);
+  __m256i S2 = _mm256_loadu_si256((__m256i *)L->S[2]);
+  __m256i S3 = _mm256_loadu_si256((__m256i *)L->S[3]);
+  __m256i R = _mm256_add_epi32(_mm256_slli_epi32(S1, 2), S1);
+  __m256i T = _mm256_slli_epi32(S1, 9);
+
+  R = _mm256_or_si256(_mm256_slli_epi32(R, 7), _mm256_srli_epi32(R, 25));
+  R = _mm256_add_epi32(_mm256_slli_epi32(R, 3), R);
+  _mm256_storeu_si256((__m256i *)Out, R);
+  S2 = _mm256_xor_si256(S2, S0);
+  S3 = _mm256_xor_si256(S3, S1);
+  S1 = _mm256_xor_si256(S1, S2);
+  S0 = _mm256_xor_si256(S0, S3);
+  S2 = _mm256_xor_si256(S2, T);
+  S3 = _mm256_or_si256(_mm256_slli_epi32(S3, 11), _mm256_srli_epi32(S3, 21));
+  _mm256_storeu_si256((__m256i *)L->S[0], S0);
+  _mm256_storeu_si256((__m256i *)L->S[1], S1);
+  _mm256_storeu_si256((__m256i *)L->S[2], S2);
+  _mm256_storeu_si256((__m256i *)L->S[3], S3);
+#elif defined(__SSE2__)
+  int k;
+  __m128i S0, S1, S2, S3, R, T;
+  for (k = 0; k < RANDOM_LANES; k += 4) {
+    S0 = _mm_loadu_si128((__m128i *)&L->S[0][k]);
+    S1 = _mm_loadu_si128((__m128i *)&L->S[1][k]);
+    S2 = _mm_loadu_si128((__m128i *)&L->S[2][k]);
+    S3 = _mm_loadu_si128((__m128i *)&L->S[3][k]);
+    R = _mm_add_epi32(_mm_slli_epi32(S1, 2), S1);
+    T = _mm_slli_epi32(S1, 9);
+    R = _mm_or_si128(_mm_slli_epi32(R, 7), _mm_srli_epi32(R, 25));
+    R = _mm_add_epi32(_mm_slli_epi32(R, 3), R);
+    _mm_storeu_si128((__m128i *)&Out[k], R);
+    S2 = _mm_xor_si128(S2, S0);
+    S3 = _mm_xor_si128(S3, S1);
+    S1 = _mm_xor_si128(S1, S2);
+    S0 = _mm_xor_si128(S0, S3);
+    S2 = _mm_xor_si128(S2, T);
+    S3 = _mm_or_si128(_mm_slli_epi32(S3, 11), _mm_srli_epi32(S3, 21));
+    _mm_storeu_si128((__m128i *)&L->S[0][k], S0);
+    _mm_storeu_si128((__m128i *)&L->S[1][k], S1);
+    _mm_storeu_si128((__m128i *)&L->S[2][k], S2);
+    _mm_storeu_si128((__m128i *)&L->S[3][k], S3);
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  int k;
+  uint32x4_t S0, S1, S2, S3, R, T;
+  for (k = 0; k < RANDOM_LANES; k += 4) {
+    S0 = vld1q_u32(&L->S[0][k]);
+    S1 = vld1q_u32(&L->S[1][k]);
+    S2 = vld1q_u32(&L->S[2][k]);
+    S3 = vld1q_u32(&L->S[3][k]);
+    R = vmulq_n_u32(S1, 5);
+    T = vshlq_n_u32(S1, 9);
+    R = vorrq_u32(vshlq_n_u32(R, 7), vshrq_n_u32(R, 25));
+    R = vmulq_n_u32(R, 9);
+    vst1q_u32(&Out[k], R);
+    S2 = veorq_u32(S2, S0);
+    S3 = veorq_u32(S3, S1);
+    S1 = veorq_u32(S1, S2);
+    S0 = veorq_u32(S0, S3);
+    S2 = veorq_u32(S2, T);
+    S3 = vorrq_u32(vshlq_n_u32(S3, 11), vshrq_n_u32(S3, 21));
+    vst1q_u32(&L->S[0][k], S0);
+    vst1q_u32(&L->S[1][k], S1);
+    vst1q_u32(&L->S[2][k], S2);
+    vst1q_u32(&L->S[3][k], S3);
+  }
+#else
+  NextRandomLanesScalar(L, Out);
+#endif
+}
+
+// Fill Count points with random positions in 1 .. Width and 1 .. Height,
+// each moving in one of the four diagonal directions (away from the edge
+// it is on, if any). Only touches the arrays and R, so threads with a
+// generator of their own can fill separate ranges at the same time.
+void FillRandomPoints(struct PointRandom *R, int16_t *X, int16_t *Y, int16_t *dX, int16_t *dY,
+                      int Count, int Width, int Height) {
+  struct RandomLanes L;
+  uint32_t RX[RANDOM_LANES], RY[RANDOM_LANES], RD[RANDOM_LANES];
+  int i, k, N;
+
+  SeedRandomLanes(&L, R);
+  for (i = 0; i < Count; i += RANDOM_LANES) {
+    NextRandomLanes(&L, RX);
+    NextRandomLanes(&L, RY);
+    NextRandomLanes(&L, RD);
+    N = Count - i < RANDOM_LANES ? Count - i : RANDOM_LANES;
+    for (k = 0; k < N; ++k) {
+      // Multiply-and-shift maps the numbers onto the range (with a bias
+      // of at most Width / 2^32, rather than a modulo's).
+      X[i + k] = 1 + (int16_t)(((uint64_t)RX[k] * Width) >> 32);
+      Y[i + k] = 1 + (int16_t)(((uint64_t)RY[k] * Height) >> 32);
+      // Selects rather than branches, so the compiler can vectorize.
+      dX[i + k] = X[i + k] == 1 ? 1 : X[i + k] == Width ? -1 : (int16_t)(RD[k] & 1) * 2 - 1;
+      dY[i + k] = Y[i + k] == 1 ? 1 : Y[i + k] == Height ? -1 : (int16_t)(RD[k] >> 1 & 1) * 2 - 1;
+    }
+  }
+}
+
+#endif
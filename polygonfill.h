@@ -0,0 +1,259 @@
+#ifndef __POLYGON_FILL_H__
+#define __POLYGON_FILL_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Filling a polygon (such as the closed loop of points, see NextInLoop)
+// with a scanline fill and an active edge table:
+// 1. Every non-horizontal edge of the polygon goes into the edge table,
+//    which is counting-sorted by the row the edge starts on.
+// 2. Going down the rows of the frame, the edges starting on a row are
+//    added to the active edges, and the ones which ended are dropped.
+//    The active edges are kept sorted by where they cross the row (an
+//    insertion sort, since the order barely changes from row to row in
+//    most polygons).
+// 3. The row is filled between the crossings, by the even-odd rule (every
+//    crossing toggles inside and outside) or the nonzero rule (inside
+//    wherever the edges going down and up do not cancel out), and every
+//    run of filled cells is a single span (e.g., PlotHSpan).
+// The edges are stepped from row to row in 16.16 fixed point, so a row
+// costs O(active edges) whatever the number of vertices, and loops which
+// cross themselves are filled like any other. Nothing is allocated once
+// the tables have grown to the number of vertices and rows.
+//
+// A row is crossed by an edge from its top row up to (but not including)
+// its bottom row, so a vertex joining two edges is only counted once.
+// PlotPointLoop draws the outline and the points over the fill, which
+// cover the rows this leaves out (like the bottom of the polygon).
+
+#define FILL_NONE 0
+#define FILL_EVEN_ODD 1
+#define FILL_NONZERO 2
+
+#define FILL_SYM '.'
+
+// 1.0 in 16.16 fixed point. (Coordinates are multiplied by it rather than
+// shifted, since they can be negative.)
+#define FILL_ONE 65536
+
+struct PolygonEdge {
+  int YTop, YBottom; // Rows the edge crosses: YTop .. YBottom - 1
+  int64_t X;         // Where the edge crosses the current row (16.16)
+  int64_t Slope;     // Change of X from one row to the next (16.16)
+  int Winding;       // 1 if the edge goes down, -1 if it goes up
+};
+
+struct PolygonFill {
+  int Rule;                    // FILL_NONE, FILL_EVEN_ODD or FILL_NONZERO
+  char Sym;                    // Symbol the polygon is filled with
+  struct PolygonEdge *Edges;   // Edge table (in loop order)
+  struct PolygonEdge **Sorted; // Edges, sorted by YTop
+  struct PolygonEdge **Active; // Active edges, sorted by X
+  int EdgeCapacity;
+  int *RowStart;               // Edges of row y: Sorted[RowStart[y] .. RowStart[y + 1] - 1]
+  int RowCapacity;
+
+  // Statistics
+  unsigned long long Spans; // Spans filled
+};
+
+struct PolygonFill PolygonFill = {.Rule = FILL_NONE, .Sym = FILL_SYM};
+
+// Set the fill rule from Spec (the value of POLYGON_FILL): "evenodd" or
+// "nonzero", optionally followed by ":<symbol>". Returns 0 if Spec is
+// not one of them.
+int SelectPolygonFill(struct PolygonFill *F, const char *Spec) {
+  size_t Length = strcspn(Spec, ":");
+
+  if (Length == 7 && !strncmp(Spec, "evenodd", 7))
+    F->Rule = FILL_EVEN_ODD;
+  else if (Length == 7 && !strncmp(Spec, "nonzero", 7))
+    F->Rule = FILL_NONZERO;
+  else if (Length == 4 && !strncmp(Spec, "none", 4))
+    F->Rule = FILL_NONE;
+  else
+    return 0;
+  if (Spec[Length] == ':' && Spec[Length + 1])
+    F->Sym = Spec[Length + 1];
+  return 1;
+}
+
+void ReleasePolygonFill(struct PolygonFill *F) {
+  free(F->Edges);
+  free(F->Sorted);
+  free(F->Active);
+  free(F->RowStart);
+  F->Edges = NULL;
+  F->Sorted = F->Active = NULL;
+  F->RowStart = NULL;
+  F->EdgeCapacity = F->RowCapacity = 0;
+}
+
+// Make room for Edges edges and Rows rows (the tables only grow, by
+// doubling). Returns 0 if the memory could not be allocated.
+int ReservePolygonFill(struct PolygonFill *F, int Edges, int Rows) {
+  int NewCapacity;
+  void *Grown;
+
+#define GROW_FILL(Field, Size)                                                 \
+  if (!(Grown = realloc(F->Field, sizeof(*F->Field) * (Size))))                \
+    return 0;                                                                  \
+  F->Field = Grown;
+
+  if (Edges > F->EdgeCapacity) {
+    NewCapacity = F->EdgeCapacity ? F->EdgeCapacity : 64;
+    while (NewCapacity < Edges)
+      NewCapacity <<= 1;
+    GROW_FILL(Edges, NewCapacity)
+    GROW_FILL(Sorted, NewCapacity)
+    GROW_FILL(Active, NewCapacity)
+    F->EdgeCapacity = NewCapacity;
+  }
+  if (Rows > F->RowCapacity) {
+    NewCapacity = F->RowCapacity ? F->RowCapacity : 64;
+    while (NewCapacity < Rows)
+      NewCapacity <<= 1;
+    GROW_FILL(RowStart, NewCapacity + 2)
+    F->RowCapacity = NewCapacity;
+  }
+#undef GROW_FILL
+  return 1;
+}
+
+int CompareEdges(const void *A, const void *B) {
+  int64_t XA = (*(struct PolygonEdge *const *)A)->X;
+  int64_t XB = (*(struct PolygonEdge *const *)B)->X;
+  return (XA > XB) - (XA < XB);
+}
+
+// Fills the cells (X0, Y) .. (X1, Y) with Color and Sym.
+typedef void (*FillSpan)(int X0, int X1, int Y, int Color, char Sym);
+
+// The cell an edge crossing at X (16.16) falls in.
+static inline int FillCell(int64_t X) { return (int)((X + FILL_ONE / 2) >> 16); }
+
+// Fill the polygon with the Count vertices (X[i], Y[i]) (the last one
+// connects back to the first) by F's rule, with Color and Sym, one Span
+// at a time. The rows are clipped to 1 .. Height (the columns are up to
+// Span).
+void FillPolygon(struct PolygonFill *F, int16_t *X, int16_t *Y, int Count, int Height,
+                 int Color, char Sym, FillSpan Span) {
+  struct PolygonEdge *E, *Moving;
+  int i, j, k, y, Edges, Active, Rows, Inside, Winding, Moves;
+  int YMin, YMax, RunX0, RunX1, HaveRun, X0, X1;
+
+  if (F->Rule == FILL_NONE || Count < 3 || Height < 1)
+    return;
+  if (!ReservePolygonFill(F, Count, Height))
+    return;
+
+  // 1. The edge table. Edges starting above row 1 start on it instead,
+  // further along.
+  Edges = 0;
+  YMin = Height + 1;
+  YMax = 0;
+  for (i = 0; i < Count; ++i) {
+    j = i + 1 < Count ? i + 1 : 0;
+    if (Y[i] == Y[j])
+      continue;
+    E = &F->Edges[Edges];
+    E->Winding = Y[j] > Y[i] ? 1 : -1;
+    k = E->Winding > 0 ? i : j; // The top end of the edge
+    E->YTop = Y[k];
+    E->YBottom = Y[k == i ? j : i];
+    E->Slope = (int64_t)(X[k == i ? j : i] - X[k]) * FILL_ONE / (E->YBottom - E->YTop);
+    E->X = (int64_t)X[k] * FILL_ONE;
+    if (E->YBottom <= 1 || E->YTop > Height)
+      continue;
+    if (E->YTop < 1) {
+      E->X += E->Slope * (1 - E->YTop);
+      E->YTop = 1;
+    }
+    if (E->YTop < YMin)
+      YMin = E->YTop;
+    if (E->YBottom > YMax)
+      YMax = E->YBottom;
+    Edges++;
+  }
+  if (!Edges)
+    return;
+  if (YMax > Height + 1)
+    YMax = Height + 1;
+
+  // Counting sort of the edges by YTop.
+  Rows = Height + 2;
+  memset(F->RowStart, 0, sizeof(int) * Rows);
+  for (i = 0; i < Edges; ++i)
+    F->RowStart[F->Edges[i].YTop + 1]++;
+  for (y = 1; y < Rows; ++y)
+    F->RowStart[y] += F->RowStart[y - 1];
+  for (i = 0; i < Edges; ++i)
+    F->Sorted[F->RowStart[F->Edges[i].YTop]++] = &F->Edges[i];
+  for (y = Rows - 1; y > 0; --y)
+    F->RowStart[y] = F->RowStart[y - 1];
+  F->RowStart[0] = 0;
+
+  // 2. Down the rows.
+  Active = 0;
+  for (y = YMin; y < YMax; ++y) {
+    // Drop the edges which ended, and step the others to this row.
+    for (i = k = 0; i < Active; ++i) {
+      E = F->Active[i];
+      if (E->YBottom <= y)
+        continue;
+      E->X += E->Slope;
+      F->Active[k++] = E;
+    }
+    Active = k;
+    // Add the edges starting on this row.
+    for (i = F->RowStart[y]; i < F->RowStart[y + 1]; ++i)
+      F->Active[Active++] = F->Sorted[i];
+    // Insertion sort by X. Edges which cross a lot of others (in a big,
+    // tangled loop) would make it quadratic, so past a few moves per
+    // edge the row is sorted with qsort instead.
+    Moves = 0;
+    for (i = 1; i < Active && Moves <= 8 * Active; ++i) {
+      Moving = F->Active[i];
+      for (k = i; k > 0 && F->Active[k - 1]->X > Moving->X; --k)
+        F->Active[k] = F->Active[k - 1];
+      F->Active[k] = Moving;
+      Moves += i - k;
+    }
+    if (i < Active)
+      qsort(F->Active, Active, sizeof(*F->Active), CompareEdges);
+
+    // 3. Fill between the crossings. Runs which touch (or overlap, once
+    // rounded to cells) are merged into one span.
+    HaveRun = 0;
+    RunX0 = RunX1 = 0;
+    Winding = 0;
+    for (i = 0; i + 1 < Active; ++i) {
+      Winding += F->Rule == FILL_EVEN_ODD ? 1 : F->Active[i]->Winding;
+      Inside = F->Rule == FILL_EVEN_ODD ? Winding & 1 : Winding != 0;
+      if (!Inside)
+        continue;
+      X0 = FillCell(F->Active[i]->X);
+      X1 = FillCell(F->Active[i + 1]->X);
+      if (HaveRun && X0 <= RunX1 + 1) {
+        if (X1 > RunX1)
+          RunX1 = X1;
+        continue;
+      }
+      if (HaveRun) {
+        Span(RunX0, RunX1, y, Color, Sym);
+        F->Spans++;
+      }
+      HaveRun = 1;
+      RunX0 = X0;
+      RunX1 = X1;
+    }
+    if (HaveRun) {
+      Span(RunX0, RunX1, y, Color, Sym);
+      F->Spans++;
+    }
+  }
+}
+
+#endif
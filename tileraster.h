@@ -0,0 +1,595 @@
+#ifndef __TILE_RASTER_H__
+#define __TILE_RASTER_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The tile rasterizer draws a batch of lines (and single cells) into the
+// back buffer using several threads.
+//
+// 1. Lines are queued with BatchLine/BatchChar (in drawing order).
+// 2. RunRasterBatch() splits the frame into TILE_WIDTH x TILE_HEIGHT tiles,
+//    and sorts the queued lines into a bin for every tile their path
+//    crosses (keeping the drawing order within each bin).
+// 3. The tiles are handed out to a fixed pool of workers (plus the calling
+//    thread), and each tile draws its bin clipped to the tile.
+//
+// Every cell belongs to exactly one tile, and each tile draws in the same
+// order as the serial code, so the back buffer ends up identical to the
+// serial result whatever the number of threads.
+//
+// The sorting (2) is a counting sort, which is shared between the threads
+// as well: each thread counts (and then fills in) the bin entries of its
+// own contiguous share of the queue, and the shares are laid out in queue
+// order within every bin.
+//
+// NOTE: This file uses the frame buffer, footprint and line routines of plotutils.h
+// (and is included by it).
+
+#define TILE_WIDTH 32
+#define TILE_HEIGHT 16
+// Every thread records its cells in its own footprint list.
+#define MAX_RASTER_THREADS FOOTPRINT_LISTS
+
+// A line from (X0, Y0) to (X1, Y1). A single cell has X0 == X1 and Y0 == Y1.
+struct RasterOp {
+  int16_t X0, Y0;
+  int16_t X1, Y1;
+  char Color;
+  char Sym;
+};
+
+struct RasterBatch {
+  struct RasterOp *Ops; // Queued lines, in drawing order.
+  int Count;
+  int Capacity;
+
+  int TilesX;         // Number of tile columns
+  int TilesY;         // Number of tile rows
+  uint32_t *BinStart; // Bin of tile t is BinOps[BinStart[t] .. BinStart[t+1]-1]
+  uint32_t *BinOps;   // Index of the ops in each bin
+  uint32_t *Shares;   // Entries of each thread's share in each bin
+                      // (then, where the share starts in BinOps)
+  uint32_t *OpTiles;  // Scratch space (per thread): the tiles crossed by one op
+  int TooLong;        // Set if an op is too long to be tiled
+  size_t BinStartCapacity;
+  size_t BinOpsCapacity;
+  size_t SharesCapacity;
+  size_t OpTilesCapacity;
+};
+
+struct RasterBatch Batch = {0};
+
+// Number of threads used by RunRasterBatch (including the caller).
+// 0 means "not configured yet": the PLOT_THREADS environment variable
+// is used (or 1 if it is not set).
+static int RasterThreads = 0;
+
+// The work handed to the threads by RunRasterPhase.
+#define RASTER_COUNT 0 // Count the bin entries of each share
+#define RASTER_FILL 1  // Fill in the bin entries of each share
+#define RASTER_DRAW 2  // Draw the tiles
+
+// The worker pool. Worker i is thread i + 1 (the caller is thread 0).
+struct RasterWorkerArgs {
+  int Thread;
+  unsigned long Generation; // Generation of the last phase before it started
+};
+static pthread_t RasterWorkers[MAX_RASTER_THREADS];
+static struct RasterWorkerArgs RasterWorkerArgs[MAX_RASTER_THREADS];
+static int NumRasterWorkers = 0;
+static pthread_mutex_t RasterLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t RasterStart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t RasterDone = PTHREAD_COND_INITIALIZER;
+static unsigned long RasterGeneration = 0; // Bumped for every phase
+static int RasterPhase = RASTER_DRAW;
+static int RasterBusy = 0; // Workers still working on the phase
+static int RasterShutdown = 0;
+static int NextTile = 0; // Next tile to hand out
+
+// Draw every queued op in order on the calling thread, and empty the
+// queue.
+void DrawRasterBatchInOrder() {
+  int i;
+  struct RasterOp *Op;
+
+  for (i = 0; i < Batch.Count; ++i) {
+    Op = &Batch.Ops[i];
+    GeneralizedPlotLine(Op->X0, Op->Y0, Op->X1, Op->Y1, Op->Color, Op->Sym);
+  }
+  Batch.Count = 0;
+}
+
+// Queue a line to be drawn by RunRasterBatch.
+// If the queue cannot grow (out of memory), the ops queued so far and
+// this line are drawn right away instead (in order, on this thread), so
+// no line is lost.
+void BatchLine(int X0, int Y0, int X1, int Y1, int Color, char Sym) {
+  struct RasterOp *Grown;
+  struct RasterOp *Op;
+  int NewCapacity;
+
+  if (Batch.Count == Batch.Capacity) {
+    NewCapacity = Batch.Capacity ? Batch.Capacity << 1 : 64;
+    Grown = (struct RasterOp *)realloc(Batch.Ops, sizeof(*Grown) * NewCapacity);
+    if (!Grown) {
+      DrawRasterBatchInOrder();
+      GeneralizedPlotLine(X0, Y0, X1, Y1, Color, Sym);
+      return;
+    }
+    Batch.Ops = Grown;
+    Batch.Capacity = NewCapacity;
+  }
+
+  Op = &Batch.Ops[Batch.Count++];
+  Op->X0 = X0;
+  Op->Y0 = Y0;
+  Op->X1 = X1;
+  Op->Y1 = Y1;
+  Op->Color = Color;
+  Op->Sym = Sym;
+}
+
+// Queue a single cell to be drawn by RunRasterBatch.
+void BatchChar(int X, int Y, int Color, char Sym) { BatchLine(X, Y, X, Y, Color, Sym); }
+
+// Ceiling of P / Q, for Q > 0.
+// (Only used with P >= 0.)
+int CeilDiv(int P, int Q) { return (P + Q - 1) / Q; }
+
+// Find the range of steps [*Lo, *Hi] of a (non-span) line which fall
+// inside the tile, where the line starts at (Major0, Minor0), steps by
+// (MajorSign, MinorSign) and is MajorLen x MinorLen cells long (see the
+// comment in RasterOpInTile), and the tile covers [MajorT0, MajorT1] x
+// [MinorT0, MinorT1]. Returns 0 if the line misses the tile.
+int StepRange(int Major0, int MajorSign, int MajorLen, int MajorT0, int MajorT1,
+              int Minor0, int MinorSign, int MinorLen, int MinorT0, int MinorT1,
+              int *Lo, int *Hi) {
+  int From, To, MinorFrom, MinorTo;
+
+  // Steps where the major axis is inside the tile.
+  From = MajorSign > 0 ? MajorT0 - Major0 : Major0 - MajorT1;
+  To = MajorSign > 0 ? MajorT1 - Major0 : Major0 - MajorT0;
+  From = From < 0 ? 0 : From;
+  To = To > MajorLen ? MajorLen : To;
+
+  // Distances moved along the minor axis while inside the tile.
+  MinorFrom = MinorSign > 0 ? MinorT0 - Minor0 : Minor0 - MinorT1;
+  MinorTo = MinorSign > 0 ? MinorT1 - Minor0 : Minor0 - MinorT0;
+  if (MinorTo < 0)
+    return 0;
+  MinorTo = MinorTo > MinorLen ? MinorLen : MinorTo;
+  // ... and the steps at which they happen.
+  if (MinorFrom > 0 &&
+      From < CeilDiv(2 * MajorLen * MinorFrom - MajorLen, 2 * MinorLen))
+    From = CeilDiv(2 * MajorLen * MinorFrom - MajorLen, 2 * MinorLen);
+  if (MinorTo < MinorLen &&
+      To > CeilDiv(2 * MajorLen * (MinorTo + 1) - MajorLen, 2 * MinorLen) - 1)
+    To = CeilDiv(2 * MajorLen * (MinorTo + 1) - MajorLen, 2 * MinorLen) - 1;
+
+  *Lo = From;
+  *Hi = To;
+  return From <= To;
+}
+
+// Draw Op, but only the cells inside the (inclusive) rectangle
+// (TX0, TY0) .. (TX1, TY1).
+// The cells are exactly the ones GeneralizedPlotLine would draw, and are
+// recorded in footprint list List (if the footprint is being recorded).
+void RasterOpInTile(struct RasterOp *Op, int TX0, int TY0, int TX1, int TY1, int List) {
+  int X0 = Op->X0, Y0 = Op->Y0, X1 = Op->X1, Y1 = Op->Y1;
+  int dX, sX, dY, sY, E, DoubleE;
+  int Lo, Hi, Steps;
+  // Kept in locals: the compiler cannot tell that writing a cell does
+  // not change Op, BackBuffer or FrameWidth.
+  char Sym = Op->Sym, Color = Op->Color;
+  int Width = FrameWidth;
+  int Record = Footprint.Recording;
+  struct Cell *C;
+
+  if (Y0 == Y1 || X0 == X1) {
+    // Spans: clip the run to the tile.
+    if (Y0 == Y1) {
+      Lo = X0 < X1 ? X0 : X1;
+      Hi = X0 < X1 ? X1 : X0;
+      if (Y0 < TY0 || Y0 > TY1)
+        return;
+      Lo = Lo < TX0 ? TX0 : Lo;
+      Hi = Hi > TX1 ? TX1 : Hi;
+      C = &BackBuffer[(Y0 - 1) * Width + (Lo - 1)];
+      for (; Lo <= Hi; ++Lo, ++C) {
+        C->Sym = Sym;
+        C->Color = Color;
+        if (Record)
+          RecordCell(&Footprint, List, C - BackBuffer);
+      }
+    } else {
+      Lo = Y0 < Y1 ? Y0 : Y1;
+      Hi = Y0 < Y1 ? Y1 : Y0;
+      if (X0 < TX0 || X0 > TX1)
+        return;
+      Lo = Lo < TY0 ? TY0 : Lo;
+      Hi = Hi > TY1 ? TY1 : Hi;
+      C = &BackBuffer[(Lo - 1) * Width + (X0 - 1)];
+      for (; Lo <= Hi; ++Lo, C += Width) {
+        C->Sym = Sym;
+        C->Color = Color;
+        if (Record)
+          RecordCell(&Footprint, List, C - BackBuffer);
+      }
+    }
+    return;
+  }
+
+  // Bresenham (as in GeneralizedPlotLine).
+  // Every step moves one cell along the major axis, and after k steps
+  // the minor axis has moved floor((2 * Minor * k + Major) / (2 * Major))
+  // cells (Major and Minor being the lengths of the two axes). This gives
+  // the exact range of steps that lands inside the tile, and lets us jump
+  // straight to the first one: the error term after I steps in X and
+  // J steps in Y is dX * (1 + J) + dY * (1 + I).
+  dX = abs(X1 - X0);
+  sX = X0 < X1 ? 1 : -1;
+  dY = -abs(Y1 - Y0);
+  sY = Y0 < Y1 ? 1 : -1;
+
+  if (dX >= -dY) {
+    if (!StepRange(X0, sX, dX, TX0, TX1, Y0, sY, -dY, TY0, TY1, &Lo, &Hi))
+      return;
+    Steps = (-2 * dY * Lo + dX) / (2 * dX);
+    E = dX * (1 + Steps) + dY * (1 + Lo);
+    X0 += sX * Lo;
+    Y0 += sY * Steps;
+  } else {
+    if (!StepRange(Y0, sY, -dY, TY0, TY1, X0, sX, dX, TX0, TX1, &Lo, &Hi))
+      return;
+    Steps = (2 * dX * Lo - dY) / (-2 * dY);
+    E = dX * (1 + Lo) + dY * (1 + Steps);
+    X0 += sX * Steps;
+    Y0 += sY * Lo;
+  }
+
+  C = &BackBuffer[(Y0 - 1) * Width + (X0 - 1)];
+  sY *= Width;
+  for (; Lo <= Hi; ++Lo) {
+    C->Sym = Sym;
+    C->Color = Color;
+    if (Record)
+      RecordCell(&Footprint, List, C - BackBuffer);
+    DoubleE = E << 1;
+    if (DoubleE >= dY) {
+      E += dY;
+      C += sX;
+    }
+    if (DoubleE <= dX) {
+      E += dX;
+      C += sY;
+    }
+  }
+}
+
+// Draw the bin of tile T (on the thread owning footprint list List).
+void RasterTile(int T, int List) {
+  uint32_t i;
+  int TX0 = (T % Batch.TilesX) * TILE_WIDTH + 1;
+  int TY0 = (T / Batch.TilesX) * TILE_HEIGHT + 1;
+  int TX1 = TX0 + TILE_WIDTH - 1;
+  int TY1 = TY0 + TILE_HEIGHT - 1;
+
+  if (TX1 > FrameWidth)
+    TX1 = FrameWidth;
+  if (TY1 > FrameHeight)
+    TY1 = FrameHeight;
+
+  for (i = Batch.BinStart[T]; i < Batch.BinStart[T + 1]; ++i)
+    RasterOpInTile(&Batch.Ops[Batch.BinOps[i]], TX0, TY0, TX1, TY1, List);
+}
+
+// Keep drawing tiles until there are none left.
+void RasterTiles(int Thread) {
+  int T;
+  int NumTiles = Batch.TilesX * Batch.TilesY;
+  while ((T = __atomic_fetch_add(&NextTile, 1, __ATOMIC_RELAXED)) < NumTiles)
+    RasterTile(T, Thread);
+}
+
+// Position along the minor axis after K steps (see RasterOpInTile).
+int MinorAt(int Minor0, int MinorSign, int MajorLen, int MinorLen, int K) {
+  if (!MajorLen)
+    return Minor0;
+  return Minor0 + MinorSign * ((2 * MinorLen * K + MajorLen) / (2 * MajorLen));
+}
+
+// Find the tiles crossed by a line (see StepRange for the parameters;
+// MajorTile/MinorTile are the tile sizes along each axis, and
+// MajorCells/MinorCells the size of the frame).
+// For every column of tiles along the major axis, the range of steps
+// inside that column gives the range of minor positions, and so the tiles
+// of that column which the line really crosses.
+// The tiles are stored in Tiles (at most TilesX + TilesY of them), and
+// their number is returned.
+int LineTiles(int Major0, int MajorSign, int MajorLen, int MajorTile, int MajorCells,
+              int Minor0, int MinorSign, int MinorLen, int MinorTile, int MinorCells,
+              int MajorIsX, uint32_t *Tiles) {
+  int Count = 0;
+  int Lo, Hi, Column, Row, From, To, CellFrom, CellTo, A, B;
+
+  Lo = MajorSign > 0 ? Major0 : Major0 - MajorLen;
+  Hi = MajorSign > 0 ? Major0 + MajorLen : Major0;
+  Lo = Lo < 1 ? 1 : Lo;
+  Hi = Hi > MajorCells ? MajorCells : Hi;
+  if (Lo > Hi)
+    return 0;
+
+  for (Column = (Lo - 1) / MajorTile; Column <= (Hi - 1) / MajorTile; ++Column) {
+    CellFrom = Column * MajorTile + 1;
+    CellTo = CellFrom + MajorTile - 1;
+    From = MajorSign > 0 ? CellFrom - Major0 : Major0 - CellTo;
+    To = MajorSign > 0 ? CellTo - Major0 : Major0 - CellFrom;
+    From = From < 0 ? 0 : From;
+    To = To > MajorLen ? MajorLen : To;
+    if (From > To)
+      continue;
+
+    A = MinorAt(Minor0, MinorSign, MajorLen, MinorLen, From);
+    B = MinorAt(Minor0, MinorSign, MajorLen, MinorLen, To);
+    if (A > B) {
+      Row = A;
+      A = B;
+      B = Row;
+    }
+    A = A < 1 ? 1 : A;
+    B = B > MinorCells ? MinorCells : B;
+    if (A > B)
+      continue;
+    for (Row = (A - 1) / MinorTile; Row <= (B - 1) / MinorTile; ++Row)
+      Tiles[Count++] = MajorIsX ? Row * Batch.TilesX + Column : Column * Batch.TilesX + Row;
+  }
+  return Count;
+}
+
+// Find the tiles crossed by Op. Returns the number of tiles stored in Tiles.
+int OpTiles(struct RasterOp *Op, uint32_t *Tiles) {
+  int dX = abs(Op->X1 - Op->X0);
+  int dY = abs(Op->Y1 - Op->Y0);
+  int sX = Op->X0 < Op->X1 ? 1 : -1;
+  int sY = Op->Y0 < Op->Y1 ? 1 : -1;
+
+  if (dX >= dY)
+    return LineTiles(Op->X0, sX, dX, TILE_WIDTH, FrameWidth, Op->Y0, sY, dY,
+                     TILE_HEIGHT, FrameHeight, 1, Tiles);
+  return LineTiles(Op->Y0, sY, dY, TILE_HEIGHT, FrameHeight, Op->X0, sX, dX,
+                   TILE_WIDTH, FrameWidth, 0, Tiles);
+}
+
+// The step arithmetic of the tiles (see StepRange) fits in an int as long
+// as both axes of a line are shorter than MAX_TILED_LENGTH cells: far
+// longer than any terminal, but not every int16_t line.
+#define MAX_TILED_LENGTH 32768
+
+// The share of the queue that belongs to thread Thread.
+void ShareOf(int Thread, int *From, int *To) {
+  *From = (int)((long long)Batch.Count * Thread / RasterThreads);
+  *To = (int)((long long)Batch.Count * (Thread + 1) / RasterThreads);
+}
+
+// Count how many entries the share of Thread adds to every bin.
+void CountShare(int Thread) {
+  int i, j, Count, From, To;
+  size_t NumTiles = (size_t)Batch.TilesX * Batch.TilesY;
+  uint32_t *Counts = &Batch.Shares[Thread * NumTiles];
+  uint32_t *Tiles = &Batch.OpTiles[Thread * (Batch.TilesX + Batch.TilesY)];
+  struct RasterOp *Op;
+
+  memset(Counts, 0, sizeof(uint32_t) * NumTiles);
+  ShareOf(Thread, &From, &To);
+  for (i = From; i < To; ++i) {
+    Op = &Batch.Ops[i];
+    if (abs(Op->X1 - Op->X0) >= MAX_TILED_LENGTH ||
+        abs(Op->Y1 - Op->Y0) >= MAX_TILED_LENGTH) {
+      Batch.TooLong = 1;
+      return;
+    }
+    Count = OpTiles(Op, Tiles);
+    for (j = 0; j < Count; ++j)
+      Counts[Tiles[j]]++;
+  }
+}
+
+// Fill in the bin entries of the share of Thread (Shares now holds
+// where the share starts within each bin).
+void FillShare(int Thread) {
+  int i, j, Count, From, To;
+  size_t NumTiles = (size_t)Batch.TilesX * Batch.TilesY;
+  uint32_t *Fill = &Batch.Shares[Thread * NumTiles];
+  uint32_t *Tiles = &Batch.OpTiles[Thread * (Batch.TilesX + Batch.TilesY)];
+
+  ShareOf(Thread, &From, &To);
+  for (i = From; i < To; ++i) {
+    Count = OpTiles(&Batch.Ops[i], Tiles);
+    for (j = 0; j < Count; ++j)
+      Batch.BinOps[Fill[Tiles[j]]++] = i;
+  }
+}
+
+void RunPhaseShare(int Phase, int Thread) {
+  if (Phase == RASTER_COUNT)
+    CountShare(Thread);
+  else if (Phase == RASTER_FILL)
+    FillShare(Thread);
+  else
+    RasterTiles(Thread);
+}
+
+void *RasterWorker(void *Args) {
+  struct RasterWorkerArgs *Self = (struct RasterWorkerArgs *)Args;
+  unsigned long Seen = Self->Generation;
+  int Phase;
+
+  for (;;) {
+    pthread_mutex_lock(&RasterLock);
+    while (RasterGeneration == Seen && !RasterShutdown)
+      pthread_cond_wait(&RasterStart, &RasterLock);
+    if (RasterShutdown) {
+      pthread_mutex_unlock(&RasterLock);
+      return NULL;
+    }
+    Seen = RasterGeneration;
+    Phase = RasterPhase;
+    pthread_mutex_unlock(&RasterLock);
+
+    RunPhaseShare(Phase, Self->Thread);
+
+    pthread_mutex_lock(&RasterLock);
+    if (--RasterBusy == 0)
+      pthread_cond_signal(&RasterDone);
+    pthread_mutex_unlock(&RasterLock);
+  }
+}
+
+// Run a phase on every thread (including this one), and wait for all of
+// them to finish it.
+void RunRasterPhase(int Phase) {
+  pthread_mutex_lock(&RasterLock);
+  RasterPhase = Phase;
+  NextTile = 0;
+  RasterBusy = NumRasterWorkers;
+  RasterGeneration++;
+  pthread_cond_broadcast(&RasterStart);
+  pthread_mutex_unlock(&RasterLock);
+
+  RunPhaseShare(Phase, 0);
+
+  pthread_mutex_lock(&RasterLock);
+  while (RasterBusy)
+    pthread_cond_wait(&RasterDone, &RasterLock);
+  pthread_mutex_unlock(&RasterLock);
+}
+
+void StopRasterWorkers() {
+  int i;
+  pthread_mutex_lock(&RasterLock);
+  RasterShutdown = 1;
+  pthread_cond_broadcast(&RasterStart);
+  pthread_mutex_unlock(&RasterLock);
+
+  for (i = 0; i < NumRasterWorkers; ++i)
+    pthread_join(RasterWorkers[i], NULL);
+  NumRasterWorkers = 0;
+  RasterShutdown = 0;
+}
+
+// Select how many threads draw each batch (including the caller).
+// Threads = 0 reads the PLOT_THREADS environment variable instead.
+void SetRasterThreads(int Threads) {
+  char *Env;
+  struct RasterWorkerArgs *Args;
+
+  if (Threads <= 0) {
+    Env = getenv("PLOT_THREADS");
+    Threads = Env ? atoi(Env) : 1;
+  }
+  if (Threads < 1)
+    Threads = 1;
+  if (Threads > MAX_RASTER_THREADS)
+    Threads = MAX_RASTER_THREADS;
+
+  StopRasterWorkers();
+  while (NumRasterWorkers < Threads - 1) {
+    Args = &RasterWorkerArgs[NumRasterWorkers];
+    Args->Thread = NumRasterWorkers + 1;
+    Args->Generation = RasterGeneration;
+    if (pthread_create(&RasterWorkers[NumRasterWorkers], NULL, RasterWorker, Args))
+      break;
+    NumRasterWorkers++;
+  }
+  RasterThreads = NumRasterWorkers + 1;
+}
+
+// Grow Array (of Capacity entries) to hold at least Needed entries.
+// Returns 0 if there was not enough memory.
+int ReserveEntries(uint32_t **Array, size_t *Capacity, size_t Needed) {
+  uint32_t *Grown;
+  if (Needed <= *Capacity)
+    return 1;
+  Grown = (uint32_t *)realloc(*Array, sizeof(uint32_t) * Needed);
+  if (!Grown)
+    return 0;
+  *Array = Grown;
+  *Capacity = Needed;
+  return 1;
+}
+
+// Sort the queued ops into per-tile bins.
+// Returns 0 if there was not enough memory (or an op is too long),
+// in which case the batch has to be drawn by a single thread.
+int BinRasterBatch() {
+  int T, Thread;
+  size_t NumTiles;
+  uint32_t Entries = 0;
+  uint32_t Count;
+
+  Batch.TilesX = (FrameWidth + TILE_WIDTH - 1) / TILE_WIDTH;
+  Batch.TilesY = (FrameHeight + TILE_HEIGHT - 1) / TILE_HEIGHT;
+  NumTiles = (size_t)Batch.TilesX * Batch.TilesY;
+  if (!ReserveEntries(&Batch.BinStart, &Batch.BinStartCapacity, NumTiles + 1) ||
+      !ReserveEntries(&Batch.Shares, &Batch.SharesCapacity, NumTiles * RasterThreads) ||
+      !ReserveEntries(&Batch.OpTiles, &Batch.OpTilesCapacity,
+                      (size_t)(Batch.TilesX + Batch.TilesY) * RasterThreads))
+    return 0;
+
+  // 1. Every thread counts the entries its share adds to each bin.
+  Batch.TooLong = 0;
+  RunRasterPhase(RASTER_COUNT);
+  if (Batch.TooLong)
+    return 0;
+
+  // 2. Lay the bins out one after the other, and the shares in order
+  //    within each bin.
+  for (T = 0; T < (int)NumTiles; ++T) {
+    Batch.BinStart[T] = Entries;
+    for (Thread = 0; Thread < RasterThreads; ++Thread) {
+      Count = Batch.Shares[Thread * NumTiles + T];
+      Batch.Shares[Thread * NumTiles + T] = Entries;
+      Entries += Count;
+    }
+  }
+  Batch.BinStart[NumTiles] = Entries;
+
+  // 3. Every thread fills in the entries of its share.
+  if (!ReserveEntries(&Batch.BinOps, &Batch.BinOpsCapacity, Entries))
+    return 0;
+  RunRasterPhase(RASTER_FILL);
+  return 1;
+}
+
+// Draw every queued op into the back buffer, and empty the queue.
+void RunRasterBatch() {
+  if (!RasterThreads)
+    SetRasterThreads(0);
+
+  // A single thread simply draws the ops in order.
+  if (RasterThreads == 1 || !BinRasterBatch()) {
+    DrawRasterBatchInOrder();
+    return;
+  }
+
+  RunRasterPhase(RASTER_DRAW);
+  Batch.Count = 0;
+}
+
+// Stop the workers and release the queue and the bins.
+void ReleaseRasterBatch() {
+  StopRasterWorkers();
+  RasterThreads = 0;
+  free(Batch.Ops);
+  free(Batch.BinStart);
+  free(Batch.BinOps);
+  free(Batch.Shares);
+  free(Batch.OpTiles);
+  Batch = (struct RasterBatch){0};
+}
+
+#endif
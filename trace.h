@@ -0,0 +1,252 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eventloop.h"
+#include "framescheduler.h"
+
+// A Trace records what made a run what it was, so the same run can be
+// replayed (and benchmarked) bit-for-bit, on any machine:
+// 1. The seed of the random points (see pointrandom.h), including the
+//    points added by KEY2,
+// 2. The size of the terminal, whenever it changes,
+// 3. Every SW/KEY sample which changed anything, and
+// 4. The number of simulation steps of every frame (which depends on
+//    how late the frames were).
+// Each is stored with the number of the frame it belongs to.
+//
+// Set TRACE_RECORD=<file> to record a run, and TRACE_REPLAY=<file> to
+// replay it instead of reading the terminal and the drivers. The replay
+// is paced like the recording was (by the FrameScheduler), or runs as
+// fast as it can with TRACE_SPEED=max.
+//
+// The file is a struct TraceHeader, followed by struct TraceRecords in
+// the order they were made. Frames without a record of their own took
+// one simulation step.
+
+#define TRACE_MAGIC 0x43525450 // "PTRC"
+#define TRACE_VERSION 1
+
+// Record types
+#define TRACE_SIZE 1  // A: width, B: height (of the terminal)
+#define TRACE_INPUT 2 // A: switches, B: KEYs pressed
+#define TRACE_STEPS 3 // A: simulation steps (if not 1)
+#define TRACE_END 4   // The run ended with this frame
+
+struct TraceHeader {
+  uint32_t Magic;
+  uint32_t Version;
+  uint32_t Seed;
+  uint32_t Reserved;
+};
+
+struct TraceRecord {
+  uint32_t Frame;
+  uint32_t Type;
+  uint32_t A;
+  uint32_t B;
+};
+
+#define TRACE_OFF 0
+#define TRACE_RECORD 1
+#define TRACE_REPLAY 2
+
+struct Trace {
+  int Mode;
+  FILE *File;
+  unsigned Seed;
+  uint32_t Frame;          // Frame being recorded (or replayed)
+  int MaxSpeed;            // Replay without waiting for the deadlines
+  int Width, Height;       // Size of the terminal (as last recorded)
+  int HaveInput;           // Switches holds the last sample
+  uint32_t Switches;       // Switches as last recorded
+  struct TraceRecord Next; // The next record to replay
+  int HaveNext;            // Next holds a record (0 at the end of the trace)
+  unsigned long Records;   // Records written (or read)
+};
+
+struct Trace Trace = {.Mode = TRACE_OFF};
+
+void WriteTraceRecord(struct Trace *T, uint32_t Type, uint32_t A, uint32_t B) {
+  struct TraceRecord R = {T->Frame, Type, A, B};
+  if (fwrite(&R, sizeof(R), 1, T->File) != 1) {
+    perror("Cannot write the trace, no longer recording");
+    fclose(T->File);
+    T->File = NULL;
+    T->Mode = TRACE_OFF;
+    return;
+  }
+  T->Records++;
+}
+
+// Read the next record of the trace into T->Next.
+void ReadTraceRecord(struct Trace *T) {
+  T->HaveNext = fread(&T->Next, sizeof(T->Next), 1, T->File) == 1;
+  if (T->HaveNext)
+    T->Records++;
+}
+
+// Take the next record of the trace into *R, if it is of the given type
+// and belongs to the current frame. Returns 0 otherwise.
+int TakeTraceRecord(struct Trace *T, uint32_t Type, struct TraceRecord *R) {
+  if (!T->HaveNext || T->Next.Frame != T->Frame || T->Next.Type != Type)
+    return 0;
+  *R = T->Next;
+  ReadTraceRecord(T);
+  return 1;
+}
+
+// Start recording (TRACE_RECORD) or replaying (TRACE_REPLAY) a trace.
+// Seed is the seed of this run; when replaying, T->Seed becomes the
+// seed of the recorded run instead. Either way, seed PointRandom with
+// T->Seed.
+// Returns 0 if the trace cannot be used (and the run goes on without it).
+int StartTrace(struct Trace *T, unsigned Seed) {
+  char *Record = getenv("TRACE_RECORD");
+  char *Replay = getenv("TRACE_REPLAY");
+  char *Speed = getenv("TRACE_SPEED");
+  struct TraceHeader Header = {TRACE_MAGIC, TRACE_VERSION, Seed, 0};
+
+  T->Seed = Seed;
+  if (Replay && *Replay) {
+    if (!(T->File = fopen(Replay, "rb"))) {
+      perror(Replay);
+      return 0;
+    }
+    if (fread(&Header, sizeof(Header), 1, T->File) != 1 || Header.Magic != TRACE_MAGIC ||
+        Header.Version != TRACE_VERSION) {
+      fprintf(stderr, "%s is not a trace (of this version)\n", Replay);
+      fclose(T->File);
+      T->File = NULL;
+      return 0;
+    }
+    T->Mode = TRACE_REPLAY;
+    T->Seed = Header.Seed;
+    T->MaxSpeed = Speed && !strcmp(Speed, "max");
+    ReadTraceRecord(T);
+    return 1;
+  }
+  if (Record && *Record) {
+    if (!(T->File = fopen(Record, "wb")) || fwrite(&Header, sizeof(Header), 1, T->File) != 1) {
+      perror(Record);
+      if (T->File)
+        fclose(T->File);
+      T->File = NULL;
+      return 0;
+    }
+    T->Mode = TRACE_RECORD;
+  }
+  return 1;
+}
+
+// Call with the size of the terminal (*Width by *Height) whenever it is
+// read: it is recorded if it changed. When replaying, it is replaced with
+// the recorded size instead.
+void TraceTerminalSize(struct Trace *T, int *Width, int *Height) {
+  struct TraceRecord R;
+
+  if (T->Mode == TRACE_RECORD && (*Width != T->Width || *Height != T->Height)) {
+    T->Width = *Width;
+    T->Height = *Height;
+    WriteTraceRecord(T, TRACE_SIZE, *Width, *Height);
+  } else if (T->Mode == TRACE_REPLAY) {
+    if (TakeTraceRecord(T, TRACE_SIZE, &R)) {
+      T->Width = R.A;
+      T->Height = R.B;
+    }
+    if (T->Width && T->Height) {
+      *Width = T->Width;
+      *Height = T->Height;
+    }
+  }
+}
+
+// Record a SW/KEY sample which is about to be acted on (if it changes
+// anything: KEYs were pressed, or the switches moved).
+void RecordInput(struct Trace *T, uint32_t Switches, uint32_t Keys) {
+  if (T->Mode != TRACE_RECORD || (!Keys && T->HaveInput && Switches == T->Switches))
+    return;
+  T->HaveInput = 1;
+  T->Switches = Switches;
+  WriteTraceRecord(T, TRACE_INPUT, Switches, Keys);
+}
+
+// Take the next recorded sample of this frame. Returns 0 once there is
+// none left.
+int ReplayInput(struct Trace *T, uint32_t *Switches, uint32_t *Keys) {
+  struct TraceRecord R;
+  if (!TakeTraceRecord(T, TRACE_INPUT, &R))
+    return 0;
+  *Switches = R.A;
+  *Keys = R.B;
+  return 1;
+}
+
+// Replay: finish the frame like it was recorded. It is paced by S (unless
+// at TRACE_SPEED=max), but its steps, resizes and end come from the trace.
+uint32_t ReplayEvents(struct Trace *T, struct EventLoop *L, struct FrameScheduler *S,
+                      int *Steps) {
+  struct TraceRecord R;
+  uint32_t Events = 0;
+  int Unused;
+
+  // SIGINT, SIGTERM and 'q' still end the replay early.
+  if (T->MaxSpeed) {
+    Events = TakeSignals(L) & EVENT_QUIT;
+  } else {
+    while (!(Events & (EVENT_FRAME | EVENT_QUIT)))
+      Events |= WaitForEvents(L, S, &Unused) & (EVENT_FRAME | EVENT_QUIT);
+    Events &= EVENT_QUIT;
+  }
+
+  *Steps = TakeTraceRecord(T, TRACE_STEPS, &R) ? (int)R.A : 1;
+  if (TakeTraceRecord(T, TRACE_END, &R) || !T->HaveNext)
+    Events |= EVENT_QUIT;
+  // The scheduler only counts the frames it paced.
+  if (T->MaxSpeed) {
+    S->Frames++;
+    S->Steps += *Steps;
+  }
+  T->Frame++;
+  // A resize recorded at the start of the next frame (see TraceEvents).
+  if (T->HaveNext && T->Next.Frame == T->Frame && T->Next.Type == TRACE_SIZE)
+    Events |= EVENT_RESIZE;
+  return Events | EVENT_FRAME;
+}
+
+// WaitForEvents, for a run which may be recorded or replayed: the steps
+// and the end of the frame are recorded (or replayed), and the frame
+// after it begins. (A resize handled after this is part of the next
+// frame.)
+uint32_t TraceEvents(struct Trace *T, struct EventLoop *L, struct FrameScheduler *S, int *Steps) {
+  uint32_t Events;
+
+  if (T->Mode == TRACE_REPLAY)
+    return ReplayEvents(T, L, S, Steps);
+  Events = WaitForEvents(L, S, Steps);
+  if (T->Mode == TRACE_RECORD) {
+    if (*Steps != 1)
+      WriteTraceRecord(T, TRACE_STEPS, *Steps, 0);
+    if (Events & EVENT_QUIT)
+      WriteTraceRecord(T, TRACE_END, 0, 0);
+  }
+  T->Frame++;
+  return Events;
+}
+
+void StopTrace(struct Trace *T, FILE *Out) {
+  if (T->Mode == TRACE_OFF)
+    return;
+  fprintf(Out, "Trace: %lu records %s over %u frames (seed %u)\n", T->Records,
+          T->Mode == TRACE_RECORD ? "recorded" : "replayed", T->Frame, T->Seed);
+  if (fclose(T->File))
+    perror("Cannot write the trace");
+  T->File = NULL;
+  T->Mode = TRACE_OFF;
+}
+
+#endif